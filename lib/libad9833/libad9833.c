@@ -15,37 +15,186 @@
  * along with this program. If not, see <http://www.gnu.org/licenses/>.
 */
 
-#include <avr/io.h>
-#include <math.h>
+#include "hal.h"
 #include "libad9833.h"
+#include "libspi.h"
 #include "globals.h"
 
+uint32_t _ad9833_tw_cache[2];               // last tuning word written to FREQ0/FREQ1
+uint8_t _ad9833_tw_valid = 0;               // bit per register, set once its cache is valid
+uint16_t _ad9833_ctrl = (1 << B28);         // last control word written
+uint8_t _ad9833_ctrl_valid = 0;             // true once _ad9833_ctrl matches the chip
+uint8_t _ad9833_burst[SPI_FRAME_MAX];       // words waiting to go out under one FSYNC
+uint8_t _ad9833_burst_len = 0;
+uint8_t _ad9833_burst_open = 0;
+
+void _ad9833_burst_flush(void)
+{
+    /*
+    This function queues any buffered words as one SPI frame, so they are all
+    sent under a single FSYNC assertion.
+    */
+
+    if (_ad9833_burst_len)
+    {
+        spi_enqueue(SPI_PRIO_HIGH, (1 << AD9833_CS), SPI_MODE_2, _ad9833_burst, _ad9833_burst_len);
+        _ad9833_burst_len = 0;
+    }
+}
+
 void _ad9833_send_16(uint16_t data)
 {
     /*
-    This function sends data to the AD9833 over the SPI bus. External functions
-    should not call this, instead use appropriate helper functions.
+    This function queues data to be sent to the AD9833 over the SPI bus. External
+    functions should not call this, instead use appropriate helper functions.
+    Inside AD9833_burst_begin()/AD9833_burst_end() words are collected and sent
+    together.
     */
 
-    if (data > 4194303)                 // 2^16 - 1
+    if (_ad9833_burst_len > (SPI_FRAME_MAX - 2))
     {
-        // data too big
-        return;
+        _ad9833_burst_flush();
     }
 
-    uint8_t msb = (data >> 8);
-    uint8_t lsb = (data & 0xFF);
+    _ad9833_burst[_ad9833_burst_len++] = (data >> 8);       // msb first
+    _ad9833_burst[_ad9833_burst_len++] = (data & 0xFF);
 
-    AD9833_PORT &= ~(1 << AD9833_CS);   // assert AD9833 chip select
+    if (!_ad9833_burst_open)
+    {
+        _ad9833_burst_flush();
+    }
+}
 
-    // send 2 bytes
-    SPDR = msb;
-    while(!(SPSR & (1<<SPIF)));
-    SPDR = lsb;
-    while(!(SPSR & (1<<SPIF)));
+void _ad9833_write_ctrl(uint16_t data)
+{
+    /*
+    This function writes a complete control word and remembers it.
+    */
 
+    _ad9833_ctrl = data;
+    _ad9833_ctrl_valid = 1;
+    _ad9833_send_16(data | AD9833_CTRL_REG);
+}
 
-    AD9833_PORT |= (1 << AD9833_CS);
+void AD9833_burst_begin(void)
+{
+    /*
+    This function starts collecting writes so that one update (for example a
+    new tuning word plus the FSELECT change) is sent under a single FSYNC.
+    */
+
+    _ad9833_burst_open = 1;
+}
+
+void AD9833_burst_end(void)
+{
+    /*
+    This function sends the words collected since AD9833_burst_begin().
+    */
+
+    _ad9833_burst_open = 0;
+    _ad9833_burst_flush();
+}
+
+uint32_t AD9833_freq_to_tw(uint32_t freq)
+{
+    /*
+    This function converts a frequency in Hz to an AD9833 tuning word, rounded
+    to nearest. Integer only, the constants are derived from AD9833_CLOCK.
+    */
+
+    uint32_t frac;
+
+    // (freq * FRAC + 2^40) >> 41 with FRAC = HI * 2^9 + LO. Dividing through
+    // by 2^9 first only drops a fraction, which can't move the result. HI
+    // needs a widening multiply, LO fits in 32 bits
+    frac = ((uint64_t)freq * AD9833_TW_FRAC_HI + (1UL << 31) +
+            ((freq * AD9833_TW_FRAC_LO) >> AD9833_TW_FRAC_LO_BITS)) >> 32;
+    return (freq * (uint32_t)AD9833_TW_INT) + frac;         // 32 bit multiply on the AVR
+}
+
+uint32_t AD9833_tw_to_freq(uint32_t tw)
+{
+    /*
+    This function converts an AD9833 tuning word back to a frequency in Hz,
+    rounded to nearest.
+    */
+
+    return ((uint64_t)tw * AD9833_CLOCK + (1UL << (AD9833_TW_BITS - 1))) >> AD9833_TW_BITS;
+}
+
+void AD9833_set_tw(uint32_t tw, uint8_t freq_reg)
+{
+    /*
+    This function writes a raw 28 bit tuning word into the appropriate
+    AD9833 frequency register. Only the 14 bit halves that differ from what the
+    register already holds are sent, using the B28 = 0 / HLB modes when only
+    one half has changed.
+    */
+
+    uint16_t reg;
+    uint32_t diff;
+    uint16_t load_mode;
+
+    if (tw > AD9833_TW_MAX)
+    {
+        tw = AD9833_TW_MAX;
+    }
+
+    // swap frequency registers if we are sweeping
+    if (freq_reg)
+    {
+        freq_reg = 1;
+        reg = AD9833_FREQ1_REG;
+    }
+    else
+    {
+        reg = AD9833_FREQ0_REG;
+    }
+
+    if (_ad9833_tw_valid & (1 << freq_reg))
+    {
+        diff = tw ^ _ad9833_tw_cache[freq_reg];
+    }
+    else
+    {
+        diff = AD9833_TW_MAX;
+    }
+
+    if (diff == 0)
+    {
+        return;
+    }
+
+    if ((diff & 0x3FFF) && (diff >> 14))
+    {
+        load_mode = (1 << B28);             // both halves, LSB then MSB
+    }
+    else if (diff & 0x3FFF)
+    {
+        load_mode = 0;                      // LSB only
+    }
+    else
+    {
+        load_mode = (1 << HLB);             // MSB only
+    }
+
+    if ((_ad9833_ctrl & AD9833_CTRL_LOAD_MASK) != load_mode)
+    {
+        _ad9833_write_ctrl((_ad9833_ctrl & ~AD9833_CTRL_LOAD_MASK) | load_mode);
+    }
+
+    if (diff & 0x3FFF)
+    {
+        _ad9833_send_16((uint16_t)(tw & 0x3FFF) | reg);
+    }
+    if (diff >> 14)
+    {
+        _ad9833_send_16((uint16_t)(tw >> 14) | reg);
+    }
+
+    _ad9833_tw_cache[freq_reg] = tw;
+    _ad9833_tw_valid |= (1 << freq_reg);
 }
 
 void AD9833_set_freq(uint32_t new_freq, uint8_t freq_reg)
@@ -55,9 +204,7 @@ void AD9833_set_freq(uint32_t new_freq, uint8_t freq_reg)
     AD9833 frequency register.
     */
 
-    uint32_t freq;
-    uint16_t msb;
-    uint16_t lsb;
+    HAL_BENCH_BEGIN(AD9833_set_freq);
 
     // test to see if requested frequency is within bounds
     if (new_freq < 1)
@@ -69,38 +216,60 @@ void AD9833_set_freq(uint32_t new_freq, uint8_t freq_reg)
         new_freq = MAX_FREQ;
     }
 
-    freq = (new_freq * pow(2, 28)) / AD9833_CLOCK;
-    
-    // swap frequency registers if we are sweeping
-    if (freq_reg)
-    {
-        msb = (int)(freq >> 14) | AD9833_FREQ1_REG;
-        lsb = (int)(freq & 0x3FFF) | AD9833_FREQ1_REG;
-    }
-    else
+    AD9833_set_tw(AD9833_freq_to_tw(new_freq), freq_reg);
+    HAL_BENCH_END(AD9833_set_freq);
+}
+
+void AD9833_ctrl_update(uint16_t clear_bits, uint16_t set_bits)
+{
+    /*
+    This function changes only the given bits of the control register, leaving
+    the rest as they were. Nothing is sent if the register would not change.
+    The B28/HLB load mode bits can't be changed here.
+    */
+
+    uint16_t new_value;
+
+    clear_bits &= ~AD9833_CTRL_LOAD_MASK;
+    set_bits &= ~AD9833_CTRL_LOAD_MASK;
+    new_value = (_ad9833_ctrl & ~clear_bits) | set_bits;
+
+    if (_ad9833_ctrl_valid && (new_value == _ad9833_ctrl))
     {
-        msb = (int)(freq >> 14) | AD9833_FREQ0_REG;
-        lsb = (int)(freq & 0x3FFF) | AD9833_FREQ0_REG;
+        return;
     }
+    _ad9833_write_ctrl(new_value);
+}
+
+void AD9833_ctrl_set_bits(uint16_t bits)
+{
+    AD9833_ctrl_update(0, bits);
+}
+
+void AD9833_ctrl_clear_bits(uint16_t bits)
+{
+    AD9833_ctrl_update(bits, 0);
+}
+
+uint16_t AD9833_get_ctrl_reg(void)
+{
+    /*
+    This function returns the control word the AD9833 currently holds.
+    */
 
-    // send the data over SPI
-    _ad9833_send_16(lsb);
-    _ad9833_send_16(msb);
+    return _ad9833_ctrl;
 }
 
 void AD9833_set_waveform(uint8_t waveform)
 {
     /*
     This function sets the desired output waveform (sine, triangle or square).
+    Other control bits (sleep, FSELECT, PSELECT) are left alone.
     */
 
-    uint16_t ctrl_reg_value;
+    uint16_t ctrl_reg_value = 0x00;
 
-    if (waveform == FUNC_SINE)                          // sine
-    {
-        ctrl_reg_value = 0x00;
-    }
-    else if (waveform == FUNC_TRI)                      // triangle
+    if (waveform == FUNC_TRI)                           // triangle
     {
         ctrl_reg_value = (1 << MODE);
     }
@@ -109,18 +278,49 @@ void AD9833_set_waveform(uint8_t waveform)
         ctrl_reg_value = (1 << OPBITEN) | (1 << DIV2);
     }
 
-    AD9833_set_ctrl_reg(ctrl_reg_value);
-    
+    AD9833_ctrl_update(AD9833_CTRL_WAVEFORM_MASK, ctrl_reg_value);
+}
+
+void AD9833_select_freq_reg(uint8_t freq_reg)
+{
+    /*
+    This function selects which frequency register (0 or 1) drives the output.
+    */
+
+    if (freq_reg)
+    {
+        AD9833_ctrl_set_bits(1 << FSELECT);
+    }
+    else
+    {
+        AD9833_ctrl_clear_bits(1 << FSELECT);
+    }
+}
+
+void AD9833_select_phase_reg(uint8_t phase_reg)
+{
+    /*
+    This function selects which phase register (0 or 1) drives the output.
+    */
+
+    if (phase_reg)
+    {
+        AD9833_ctrl_set_bits(1 << PSELECT);
+    }
+    else
+    {
+        AD9833_ctrl_clear_bits(1 << PSELECT);
+    }
 }
+
 void AD9833_set_ctrl_reg(uint16_t data)
 {
     /*
-    This function sets the AD9833 control register correctly. It should be used for all
-    writes to control register.
+    This function writes the whole AD9833 control register (apart from the load
+    mode bits). Prefer AD9833_ctrl_update() which keeps the other settings.
     */
 
-    uint16_t new_value = data | (1 << B28);
-    _ad9833_send_16(new_value);
+    AD9833_ctrl_update(~AD9833_CTRL_LOAD_MASK, data);
 }
 
 void AD9833_set_phase(uint16_t phase)
@@ -143,6 +343,15 @@ void AD9833_set_phase(uint16_t phase)
     _ad9833_send_16(phase);
 }
 
+void AD9833_set_phase_reg(uint16_t phase, uint8_t phase_reg)
+{
+    /*
+    This function writes a raw 12 bit phase word into PHASE0 or PHASE1.
+    */
+
+    _ad9833_send_16((phase & 0x0FFF) | (phase_reg ? AD9833_PHASE1_REG : AD9833_PHASE0_REG));
+}
+
 void AD9833_reset(uint8_t reset)
 {
     /*
@@ -151,25 +360,27 @@ void AD9833_reset(uint8_t reset)
 
     if (reset == 0)             // disable reset
     {
-        AD9833_set_ctrl_reg(0x00);
+        AD9833_ctrl_clear_bits(1 << AD9833_RESET);
     }
     else if (reset == 1)        // enable reset
     {
-        AD9833_set_ctrl_reg(1 << AD9833_RESET);
+        AD9833_ctrl_set_bits(1 << AD9833_RESET);
     }
 }
+
 void AD9833_sleep(uint8_t sleep_mode)
 {
     /*
-    This function enables or disables AD9833 sleep modes.
+    This function enables or disables AD9833 sleep modes. The waveform and
+    register selects are kept.
     */
 
     if (sleep_mode == 0)            // normal mode
     {
-        AD9833_set_ctrl_reg(0x00);
+        AD9833_ctrl_clear_bits((1 << SLEEP1) | (1 << SLEEP12));
     }
     else if (sleep_mode == 1)       // sleep mode
     {
-        AD9833_set_ctrl_reg((1 << SLEEP1) | (1 << SLEEP12));
+        AD9833_ctrl_set_bits((1 << SLEEP1) | (1 << SLEEP12));
     }
-}
\ No newline at end of file
+}
@@ -15,13 +15,51 @@
  * along with this program. If not, see <http://www.gnu.org/licenses/>.
 */
 
-// prototypes
+// tuning word engine. The AD9833 tuning word is freq * 2^28 / AD9833_CLOCK, this is
+// split into an integer part and a fractional multiplier (scaled by 2^41). The
+// multiplier is split again at bit 9, so the top 32 bits take one 32x32->64
+// multiply and the bottom 9 bits a 32 bit one (freq must be below 2^23). Rounding
+// is exact (nearest) for a 25 MHz clock over 1 Hz..MAX_FREQ.
+#define AD9833_TW_BITS          28
+#define AD9833_TW_MAX           ((1UL << AD9833_TW_BITS) - 1)
+#define AD9833_TW_FRAC_SHIFT    41
+#define AD9833_TW_INT           ((1ULL << AD9833_TW_BITS) / AD9833_CLOCK)
+#define AD9833_TW_REM           ((1ULL << AD9833_TW_BITS) % AD9833_CLOCK)
+#define AD9833_TW_FRAC          (((((AD9833_TW_REM << 20) / AD9833_CLOCK)) << 21) + \
+                                ((((AD9833_TW_REM << 20) % AD9833_CLOCK) << 21) + (AD9833_CLOCK / 2)) / AD9833_CLOCK)
+#define AD9833_TW_FRAC_LO_BITS  (AD9833_TW_FRAC_SHIFT - 32)
+#define AD9833_TW_FRAC_HI       ((uint32_t)(AD9833_TW_FRAC >> AD9833_TW_FRAC_LO_BITS))
+#define AD9833_TW_FRAC_LO       ((uint32_t)(AD9833_TW_FRAC & ((1UL << AD9833_TW_FRAC_LO_BITS) - 1)))
+
+// control register model. The driver keeps a copy of the control word and
+// changes individual fields, so waveform, sleep, reset and the register selects
+// don't overwrite each other. A write only goes out if the word changes.
+
+// frequency register load mode bits, managed by AD9833_set_tw
+#define AD9833_CTRL_LOAD_MASK   ((1 << B28) | (1 << HLB))
+#define AD9833_CTRL_WAVEFORM_MASK ((1 << MODE) | (1 << OPBITEN) | (1 << DIV2))
 
+// NOTE: the driver keeps a copy of what it last wrote to the chip, so all writes
+// should come from one context at a time (main loop, or a running timer engine)
+
+// prototypes
 
 void _ad9833_send_16(uint16_t data);
+void AD9833_burst_begin(void);
+void AD9833_burst_end(void);
+uint32_t AD9833_freq_to_tw(uint32_t freq);
+uint32_t AD9833_tw_to_freq(uint32_t tw);
+void AD9833_set_tw(uint32_t tw, uint8_t freq_reg);
 void AD9833_set_freq(uint32_t new_freq, uint8_t freq_reg);
+void AD9833_ctrl_update(uint16_t clear_bits, uint16_t set_bits);
+void AD9833_ctrl_set_bits(uint16_t bits);
+void AD9833_ctrl_clear_bits(uint16_t bits);
+uint16_t AD9833_get_ctrl_reg(void);
 void AD9833_set_waveform(uint8_t waveform);
+void AD9833_select_freq_reg(uint8_t freq_reg);
+void AD9833_select_phase_reg(uint8_t phase_reg);
 void AD9833_set_ctrl_reg(uint16_t data);
 void AD9833_set_phase(uint16_t phase);
+void AD9833_set_phase_reg(uint16_t phase, uint8_t phase_reg);
 void AD9833_reset(uint8_t reset);
 void AD9833_sleep(uint8_t sleep_mode);
\ No newline at end of file
@@ -15,59 +15,224 @@
  * along with this program. If not, see <http://www.gnu.org/licenses/>.
 */
 
-#include <avr/io.h>
-#include <avr/interrupt.h>
+#include "hal.h"
 #include "libadc.h"
 #include "globals.h"
 
-//volatile uint16_t disp_select_value;
-//volatile uint16_t func_select_value;
-volatile uint8_t adc_channel = DISP_SEL_CH;
+// channels converted in turn by the background scanner
+const uint8_t _adc_scan_channels[ADC_SCAN_LEN] = {DISP_SEL_CH, FUNC_SEL_CH};
+
+volatile uint16_t _adc_value[8];            // latest averaged reading, per channel
+volatile uint8_t _adc_seq[8];               // one more each time _adc_value is published
+uint16_t _adc_sum[ADC_SCAN_LEN];
+uint8_t _adc_count[ADC_SCAN_LEN];
+uint8_t _adc_scan_pos = 0;                  // index of the channel being converted
+
+// selector switch windows, in ADC counts, for each ladder position
+const adc_window_t _adc_ladder[ADC_LADDER_POSITIONS] PROGMEM =
+{
+    {601, 1023},
+    {481, 549},
+    {301, 369},
+    {221, 279},
+    {186, 218},
+    {0, 183}
+};
 
 void adc_init(void)
 {
     /*
-    This function configures the ADC for use.
+    This function configures the ADC for use, takes a first reading of every
+    scanned channel so adc_get() is valid straight away, then hands the ADC to
+    the background scanner. Conversions are triggered by TIMER1 compare match
+    B, so scanning starts once the tick timer is running.
     */
 
-    // set ADC ref = Vcc
-    ADMUX |= (1 << REFS0);
+    hal_adc_init();
+
+    for (uint8_t i = 0; i < ADC_SCAN_LEN; i++)
+    {
+        _adc_value[_adc_scan_channels[i]] = read_adc(_adc_scan_channels[i]);
+        _adc_seq[_adc_scan_channels[i]] += 1;
+    }
 
-    // enable ADC, start conversion, set prescalar
-    ADCSRA |= (1 << ADSC) | (1 << ADEN) | (1 << ADPS2) | (1 << ADPS1) | (1 << ADPS0);
+    _adc_scan_pos = 0;
+    hal_adc_scan_start(_adc_scan_channels[0], ADC_SC_OVF);
 }
 
 uint16_t read_adc(uint8_t channel)
 {
-    ADMUX = (ADMUX & 0xF8) | channel;
-    ADCSRA |= (1 << ADSC);
-    while (ADCSRA & (1 << ADSC));
-    return ADC;
+    /*
+    This function does a single blocking conversion. Only for use before the
+    scanner is started, use adc_get() after that.
+    */
+
+    hal_adc_start(channel);
+    while (hal_adc_busy());
+    return hal_adc_result();
 }
-/*ISR(ADC_vect)
+
+uint16_t adc_get(uint8_t channel)
+{
+    /*
+    This function returns the latest averaged reading of a scanned channel.
+    It doesn't wait for a conversion.
+    */
+
+    uint16_t value = 0;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        value = _adc_value[channel & 0x07];
+    }
+    return value;
+}
+
+uint16_t adc_get_sample(uint8_t channel, uint8_t *seq)
 {
-    uint8_t admux = ADMUX;
-    if (adc_channel == DISP_SEL_CH)
+    /*
+    This function returns the latest averaged reading of a scanned channel,
+    and in seq the sequence number it was published with, so a caller can
+    tell a new sample from one it has already seen.
+    */
+
+    uint16_t value = 0;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
     {
-        disp_select_value = ADC;
-        admux ^= 1;
-        adc_channel = FUNC_SEL_CH;
-        PORTD ^= (1 << PD7);
-        
-        
+        value = _adc_value[channel & 0x07];
+        *seq = _adc_seq[channel & 0x07];
+    }
+    return value;
+}
+
+uint16_t _adc_window_distance(uint8_t position, uint16_t reading)
+{
+    /*
+    This function returns how far a reading is outside a position's window,
+    0 if it is inside.
+    */
 
+    uint16_t low = pgm_read_word(&_adc_ladder[position].low);
+    uint16_t high = pgm_read_word(&_adc_ladder[position].high);
+
+    if (reading < low)
+    {
+        return low - reading;
+    }
+    if (reading > high)
+    {
+        return reading - high;
+    }
+    return 0;
+}
+
+uint8_t adc_ladder_value(const adc_ladder_t *ladder)
+{
+    /*
+    This function returns the value of a ladder's current position, without
+    looking at a new reading. ADC_LADDER_NONE before the first one.
+    */
+
+    if (ladder->position == ADC_LADDER_NONE)
+    {
+        return ADC_LADDER_NONE;
+    }
+    return pgm_read_byte(&ladder->values[ladder->position]);
+}
+
+uint8_t adc_ladder_decode(adc_ladder_t *ladder, uint16_t reading, uint8_t seq)
+{
+    /*
+    This function decodes a selector sample into a switch position and
+    returns that position's value. The first sample always picks the nearest
+    window, after that the position only moves once samples have settled in
+    another window. A sample with the same seq as the last one is not counted
+    again.
+    */
+
+    uint8_t nearest = 0;
+    uint16_t best = 0xFFFF;
+
+    if ((ladder->position != ADC_LADDER_NONE) && (seq == ladder->seq))
+    {
+        return pgm_read_byte(&ladder->values[ladder->position]);
+    }
+    ladder->seq = seq;
+
+    // still close enough to the current window
+    if ((ladder->position != ADC_LADDER_NONE) &&
+        (_adc_window_distance(ladder->position, reading) <= ADC_LADDER_HYST))
+    {
+        ladder->count = 0;
+        return pgm_read_byte(&ladder->values[ladder->position]);
+    }
+
+    for (uint8_t i = 0; i < ADC_LADDER_POSITIONS; i++)
+    {
+        uint16_t distance = _adc_window_distance(i, reading);
+
+        if (distance < best)
+        {
+            best = distance;
+            nearest = i;
+        }
+    }
+
+    if (ladder->position == ADC_LADDER_NONE)
+    {
+        ladder->position = nearest;
+        ladder->count = 0;
+    }
+    else if (best != 0)
+    {
+        // in a gap between windows, wait
+        ladder->count = 0;
     }
     else
     {
-        func_select_value = ADC;
-        admux ^= 1;
-        adc_channel = DISP_SEL_CH;
-        PORTD ^= (1 << PD5);
+        if (nearest != ladder->candidate)
+        {
+            ladder->candidate = nearest;
+            ladder->count = 0;
+        }
+        ladder->count += 1;
+        if (ladder->count >= ADC_LADDER_STABLE)
+        {
+            ladder->position = nearest;
+            ladder->count = 0;
+        }
+    }
+
+    return pgm_read_byte(&ladder->values[ladder->position]);
+}
+
+ISR(ADC_vect)
+{
+    /*
+    ADC conversion complete interrupt. Adds the reading to its channel's
+    average, publishes the average every ADC_SCAN_SAMPLES readings and moves on
+    to the next channel.
+    */
+
+    uint8_t pos = _adc_scan_pos;
+
+    _adc_sum[pos] += hal_adc_result();
+    _adc_count[pos] += 1;
+    if (_adc_count[pos] >= ADC_SCAN_SAMPLES)
+    {
+        _adc_value[_adc_scan_channels[pos]] = _adc_sum[pos] >> ADC_SCAN_SHIFT;
+        _adc_seq[_adc_scan_channels[pos]] += 1;
+        _adc_sum[pos] = 0;
+        _adc_count[pos] = 0;
+    }
+
+    pos += 1;
+    if (pos >= ADC_SCAN_LEN)
+    {
+        pos = 0;
     }
-    ADMUX = admux;
-    ADCSRA |= (1 << ADSC);
+    _adc_scan_pos = pos;
 
-    
-    
+    hal_adc_scan_next(_adc_scan_channels[pos], ADC_SC_OVF);
 }
-*/
\ No newline at end of file
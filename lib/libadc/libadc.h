@@ -17,7 +17,43 @@
 
 
 
+// background scanner. Each conversion is started by TIMER1 compare match B,
+// which moves on by ADC_SC_OVF timer counts each time. Channels are converted
+// in turn and ADC_SCAN_SAMPLES readings of each are averaged.
+#define ADC_SCAN_LEN            2           // entries in _adc_scan_channels
+#define ADC_SCAN_SHIFT          2
+#define ADC_SCAN_SAMPLES        (1 << ADC_SCAN_SHIFT)
+
+// resistor ladder decoding for the selector switches. A reading must leave
+// the current position's window by more than ADC_LADDER_HYST counts, and land
+// in another window for ADC_LADDER_STABLE new averaged samples in a row,
+// before the position changes. Readings in the gaps between windows keep the
+// current position. A sample is only counted once however often it is decoded.
+#define ADC_LADDER_POSITIONS    6
+#define ADC_LADDER_HYST         8
+#define ADC_LADDER_STABLE       3
+#define ADC_LADDER_NONE         0xFF
+
+typedef struct
+{
+    uint16_t low;
+    uint16_t high;
+} adc_window_t;
+
+typedef struct
+{
+    const uint8_t *values;                  // PROGMEM, value returned for each position
+    uint8_t position;                       // ADC_LADDER_NONE until the first reading
+    uint8_t candidate;                      // position the readings are moving to
+    uint8_t count;                          // samples in a row in the candidate window
+    uint8_t seq;                            // sequence number of the last sample decoded
+} adc_ladder_t;
+
 // prototypes
 
 void adc_init(void);
-uint16_t read_adc(uint8_t channel);
\ No newline at end of file
+uint16_t read_adc(uint8_t channel);
+uint16_t adc_get(uint8_t channel);
+uint16_t adc_get_sample(uint8_t channel, uint8_t *seq);
+uint8_t adc_ladder_decode(adc_ladder_t *ladder, uint16_t reading, uint8_t seq);
+uint8_t adc_ladder_value(const adc_ladder_t *ladder);
\ No newline at end of file
@@ -16,62 +16,177 @@
 */
 
 #include <stdlib.h>
-#include <avr/io.h>
-#include <util/delay.h>
 #include <string.h>
-#include <math.h>
-#include <avr/interrupt.h>
+#include "hal.h"
 #include "libbase4.h"
 #include "globals.h"
 #include "libad9833.h"
 #include "libadc.h"
 #include "libmax7221.h"
 #include "librotaryencoder.h"
+#include "libspi.h"
+#include "libpanel.h"
+#include "libevent.h"
+#include "libsched.h"
+#include "libremote.h"
+#include "libmodulation.h"
+#include "libsettings.h"
 
-uint16_t _control_reg;
 volatile uint8_t rot_enc_dir;
-volatile uint8_t rot_enc_pb = 0;
 uint32_t frequency = DEFAULT_FREQ;
 uint16_t phase = DEFAULT_PHASE;
-uint8_t func_select_state = FUNC_SINE;
+uint8_t func_select_state = FUNC_SINE;       // function running, from the panel or the remote
+uint8_t func_select_panel = FUNC_SINE;       // function select position last read
 uint8_t disp_select_state = DISP_FREQ;
 uint16_t sweep_interval_counter;
 uint8_t selected_digit = 1;
 uint32_t sweep_start_freq = SWEEP_START_DEFAULT;
 uint32_t sweep_stop_freq = SWEEP_STOP_DEFAULT;
-uint32_t sweep_interval = SWEEP_TIME_DEFAULT;
-uint32_t sweep_delta;
-uint32_t saved_frequency;
+uint32_t sweep_time = SWEEP_TIME_DEFAULT;
+sweep_timebase_t sweep_tb;                  // timer settings for the sweep
+uint32_t sweep_dither_acc;                  // periods * the fraction of a count owed
+uint16_t sweep_period_count;                // timer periods left in this step
+uint32_t sweep_start_tw;                    // sweep state, in AD9833 tuning words
+uint32_t sweep_stop_tw;
+uint64_t sweep_delta_fp;                    // linear sweep: step size, 32.32 fixed point
+uint64_t sweep_acc_fp;                      // linear sweep: position, 32.32 fixed point
+uint8_t sweep_descending;                   // linear sweep: true if stop is below start
+uint32_t sweep_tw;
+uint8_t sweep_mode = FUNC_LIN_SWEEP;        // FUNC_LIN_SWEEP or FUNC_LOG_SWEEP
+uint32_t sweep_steps;                       // steps per sweep
+uint32_t sweep_step_count;                  // steps taken in the current sweep
+uint32_t sweep_log_ratio;                   // log sweep: (per step ratio - 1) * 2^32, (1 - ratio) * 2^32 going down
+uint8_t sweep_log_octaves;                  // log sweep: whole octaves per step on top of the ratio
+uint32_t sweep_log_m;                       // log sweep: tuning word << sweep_log_shift
+uint8_t sweep_log_shift;
+int32_t sweep_endpoint_error = 0;           // log sweep: where the last step would have landed, minus stop (tuning words)
+volatile uint16_t sweep_overruns = 0;       // steps skipped because the last one was still on the bus
 volatile uint16_t disp_select_value;
 volatile uint16_t func_select_value;
 volatile uint16_t adc_reading;
 uint8_t is_sweep_started = 0;
+uint8_t is_ad9833_asleep = 0;               // true while the output enable switch is off
 
+// TIMER0 prescalers from CS0 = SWEEP_CS_FIRST up
+const uint16_t _sweep_prescale[SWEEP_PRESCALERS] PROGMEM = {8, 64, 256, 1024};
 
-uint16_t sweep_times[] = {50, 100, 250, 500, 1000, 2000};
-uint32_t selected_digit_multiplier[] = {1, 10, 100, 1000, 10000, 100000, 1000000};
+// selector switch positions, top of the ladder first. Position 5 is not currently used
+const uint8_t _disp_sel_values[ADC_LADDER_POSITIONS] PROGMEM =
+{
+    DISP_FREQ, DISP_PHASE, DISP_SWEEP_START, DISP_SWEEP_STOP, DISP_SWEEP_TIME, 5
+};
+const uint8_t _func_sel_values[ADC_LADDER_POSITIONS] PROGMEM =
+{
+    FUNC_SINE, FUNC_TRI, FUNC_SQUARE, FUNC_LIN_SWEEP, FUNC_LOG_SWEEP, 5
+};
+adc_ladder_t _disp_sel_ladder = {_disp_sel_values, ADC_LADDER_NONE, ADC_LADDER_NONE, 0, 0};
+adc_ladder_t _func_sel_ladder = {_func_sel_values, ADC_LADDER_NONE, ADC_LADDER_NONE, 0, 0};
+uint32_t selected_digit_multiplier[DIGITS_SWEEP_TIME] = {1, 10, 100, 1000, 10000, 100000, 1000000, 10000000};
 
 
-volatile uint8_t rot_enc_cw = 0;
-volatile uint8_t rot_enc_ccw = 0;
 
-volatile uint8_t tick_flag = 0;
+int16_t rot_enc_detents = 0;                // input events gathered since the last tick
+uint8_t rot_enc_presses = 0;
+uint8_t rot_enc_long_press = 0;
 uint8_t freq_reg_select = 0;
 
 uint8_t digit_flash_counter = 0;            // counts how many times we have flashed the digit
 uint16_t digit_flash_tick_counter = 0;      // counts the system ticks
 uint8_t is_digit_flashing = 0;
 
+uint8_t boot_stage = BOOT_DONE;
+uint8_t boot_ticks = 0;                     // ticks left in the boot display stage
+
 void initial_setup(void)
 {
     /*
-    This function sets initial frequency and phase, and updates the display.
-    Only used on startup.
+    This function loads the starting frequency, phase and waveform into the
+    AD9833 under reset and then releases it, so the output is right from its
+    first cycle. Only used on startup, the display is started afterwards by
+    start_boot_display().
     */
 
+    AD9833_reset(1);
     AD9833_set_freq(frequency, 0);
     AD9833_set_phase(phase);
-    update_display();
+    if ((func_select_state == FUNC_SINE) || (func_select_state == FUNC_TRI) || (func_select_state == FUNC_SQUARE))
+    {
+        AD9833_set_waveform(func_select_state);
+    }
+    AD9833_reset(0);
+}
+
+void start_boot_display(void)
+{
+    /*
+    This function starts the lamp test and splash screen. They are stepped by
+    the display task, so the output and the controls are live meanwhile.
+    */
+
+    boot_display_stage(BOOT_LAMP_TEST);
+}
+
+void boot_display_stage(uint8_t stage)
+{
+    /*
+    This function moves the boot display on to a stage, passing over any
+    with no time set. At BOOT_DONE the display shows the current setting.
+    */
+
+    if ((stage == BOOT_LAMP_TEST) && (BOOT_LAMP_TEST_TICKS == 0))
+    {
+        stage = BOOT_SPLASH;
+    }
+    if ((stage == BOOT_SPLASH) && (BOOT_SPLASH_TICKS == 0))
+    {
+        stage = BOOT_DONE;
+    }
+    boot_stage = stage;
+
+    display_test(stage == BOOT_LAMP_TEST);
+    if (stage == BOOT_LAMP_TEST)
+    {
+        boot_ticks = BOOT_LAMP_TEST_TICKS;
+    }
+    else if (stage == BOOT_SPLASH)
+    {
+        max7221_splash();
+        boot_ticks = BOOT_SPLASH_TICKS;
+    }
+    else
+    {
+        update_display();
+    }
+}
+
+void check_boot_display(void)
+{
+    /*
+    This function counts down the boot display stage, call it once per tick.
+    */
+
+    if (boot_stage == BOOT_DONE)
+    {
+        return;
+    }
+
+    boot_ticks -= 1;
+    if (boot_ticks == 0)
+    {
+        boot_display_stage(boot_stage + 1);
+    }
+}
+
+void skip_boot_display(void)
+{
+    /*
+    This function ends the boot display early.
+    */
+
+    if (boot_stage != BOOT_DONE)
+    {
+        boot_display_stage(BOOT_DONE);
+    }
 }
 
 void check_digit_flash(void)
@@ -103,49 +218,35 @@ void check_digit_flash(void)
             }
 }
 
-void spi_init(void)
-{
-    /*
-    This function initialises the SPI bus.
-    */
-
-    // set output pins. NOTE: SS Must be set as output even though not used!!!
-    SPI_DDR |= (1 << SPIE) | (1 << SPI_SCK) | (1 << SPI_MOSI) | (1 << MAX7221_CS) | (1 << SPI_SS);
-
-    // set outputs
-    SPI_PORT &= ~(1 << SPI_SS);
-    SPI_PORT |= (1 << MAX7221_CS) | (1 << SPI_SCK);
-    AD9833_DDR |= (1 << AD9833_CS);
-    AD9833_PORT |= (1 << AD9833_CS);
-
-    // enable SPI, master mode CPOL = 1, frequency = 8 MHz
-    SPCR |= (1 << SPE) | (1 << MSTR) | (1 << CPOL);
-    SPSR |= (1 << SPI2X);
-}
-
 void check_rot_enc_pb(void)
 {
     /*
-    This function checks if the rotary encoder pushbutton has been pressed. This will 
-    be triggered from interrupt.
+    This function checks if the rotary encoder pushbutton has been pressed. A
+    press moves to the next digit, holding it goes back to the first digit.
     */
 
     uint8_t current_digit = selected_digit;
 
-    if (rot_enc_pb)
+    for (; rot_enc_presses; rot_enc_presses--)
     {
         current_digit = current_digit + 1;
 
-        if (current_digit > 7) 
+        if (current_digit > DIGITS_SWEEP_TIME)
         {
 
             current_digit = 1;
         }
         
         selected_digit = current_digit;
-        rot_enc_pb = 0;
         is_digit_flashing = 1;
     }
+
+    if (rot_enc_long_press)
+    {
+        selected_digit = 1;
+        is_digit_flashing = 1;
+        rot_enc_long_press = 0;
+    }
 }
 
 void set_frequency(void)
@@ -155,6 +256,8 @@ void set_frequency(void)
     the preferred function to set frequency.
     */
     
+    HAL_BENCH_BEGIN(set_frequency);
+
     // bounds checks
     if ((func_select_state == FUNC_SINE) && (frequency > MAX_FREQ))
     {
@@ -175,44 +278,34 @@ void set_frequency(void)
 
     AD9833_set_freq(frequency, 0);
     max7221_display_int(frequency);
+    HAL_BENCH_END(set_frequency);
 }
 
-uint8_t read_disp_sel(void)
+void update_selectors(void)
 {
     /*
-    This function reads the display select control.
+    This function feeds the latest selector samples to the ladder decoders.
+    Samples they have already seen are not counted again, so this can be
+    called more often than the ADC publishes.
     */
-    
-    // read the ADC
-    uint16_t adc_reading = read_adc(DISP_SEL_CH);
 
-    if (adc_reading > 600)
-    {
-        return DISP_FREQ;      // display fixed frequency
-    }
-    else if (adc_reading < 550 && adc_reading > 480)
-    {
+    uint16_t reading;
+    uint8_t seq;
 
-        return DISP_PHASE;      // display phase
-    }
-    else if (adc_reading < 370 && adc_reading > 300)
-    {
-        return DISP_SWEEP_START;      // display sweep start frequency
-    }
-    else if (adc_reading < 280 && adc_reading > 220)
-    {
-        return DISP_SWEEP_STOP;      // display sweep end frequency
-    }
-    else if (adc_reading < 219 && adc_reading > 185)
-    {
-        return DISP_SWEEP_TIME;      // display sweep time
-    }
-    else if (adc_reading < 184)
-    {
-        return 5;      // not currently used
-    }
+    reading = adc_get_sample(DISP_SEL_CH, &seq);
+    adc_ladder_decode(&_disp_sel_ladder, reading, seq);
+    reading = adc_get_sample(FUNC_SEL_CH, &seq);
+    adc_ladder_decode(&_func_sel_ladder, reading, seq);
+}
 
-    return 6;               // error if we return from here
+uint8_t read_disp_sel(void)
+{
+    /*
+    This function reads the display select control, as last decoded by
+    update_selectors().
+    */
+    
+    return adc_ladder_value(&_disp_sel_ladder);
 }
 
 void check_disp_sel(void)
@@ -234,38 +327,11 @@ void check_disp_sel(void)
 uint8_t read_func_sel(void)
 {
     /*
-    This function reads the function select control.
+    This function reads the function select control, as last decoded by
+    update_selectors().
     */
     
-    // read the ADC
-    uint16_t adc_reading = read_adc(FUNC_SEL_CH);
-
-    if (adc_reading > 600)
-    {
-        return FUNC_SINE;                               // sine wave selected
-    }
-    else if (adc_reading < 550 && adc_reading > 480)
-    {
-        
-        return FUNC_TRI;                                // triangle wave selected
-    }
-    else if (adc_reading < 370 && adc_reading > 300)
-    {
-        return FUNC_SQUARE;                             // square wave selected
-    }
-    else if (adc_reading < 280 && adc_reading > 220)
-    {
-        return FUNC_LIN_SWEEP;                          // linear sweep selected
-    }
-    else if (adc_reading < 219 && adc_reading > 185)
-    {
-        return 4;                                       // log sweep selected (NOT IMPLEMENTED)
-    }
-    else if (adc_reading < 184)
-    {
-        return 5;                                       // not currently used
-    }
-    return 6;                                           // would be an error to return from here
+    return adc_ladder_value(&_func_sel_ladder);
 }
 
 void set_initial_func_sel_state(void)
@@ -274,7 +340,9 @@ void set_initial_func_sel_state(void)
     This function reads the function control on initial startup.
     */
 
+    update_selectors();
     func_select_state = read_func_sel();
+    func_select_panel = func_select_state;
 }
 void set_initial_disp_sel_state(void)
 {
@@ -282,6 +350,7 @@ void set_initial_disp_sel_state(void)
     This function reads the display control on initial startup.
     */
    
+    update_selectors();
     disp_select_state = read_disp_sel();
 }
 
@@ -292,28 +361,33 @@ void check_func_sel(void)
     select new function.
     */
 
+    HAL_BENCH_BEGIN(check_func_sel);
+
     uint8_t new_func_sel_state = read_func_sel();
     
-    if (new_func_sel_state != func_select_state)
+    // only a move of the control changes the function, so a waveform set
+    // over the remote stays until the control is turned
+    if (new_func_sel_state != func_select_panel)
     {
         // if the selected function is non-sweep:
         if ((new_func_sel_state == FUNC_SINE) || (new_func_sel_state == FUNC_TRI) || (new_func_sel_state == FUNC_SQUARE))
         {
-            AD9833_set_waveform(new_func_sel_state);
-
             // if sweep timer is running, stop it and restore frequency
-            if (TCCR0B & (1 << CS01))
+            if (hal_sweep_timer_running())
             {
                 stop_sweep();
             }
+
+            AD9833_set_waveform(new_func_sel_state);
         }
-        else if (new_func_sel_state == FUNC_LIN_SWEEP)
+        else if ((new_func_sel_state == FUNC_LIN_SWEEP) || (new_func_sel_state == FUNC_LOG_SWEEP))
         {
-            calculate_sweep_delta();
-            start_sweep();
+            start_sweep(new_func_sel_state);
         }
+        func_select_state = new_func_sel_state;
     }
-    func_select_state = new_func_sel_state;
+    func_select_panel = new_func_sel_state;
+    HAL_BENCH_END(check_func_sel);
 }
 
 void init_sweep_timer(void)
@@ -322,45 +396,134 @@ void init_sweep_timer(void)
     This function initialises the frequency sweep timer, TIMER0.
     */
 
-    TCCR0A = (1 << WGM01);          // set CTC mode
-    OCR0A = SWEEP_TIMER_OVF;        // set overflow value
-    TCNT0 = 0x00;                   // ensure timer is reset to 0
-    cli();
-    TIMSK0 |= (1 << OCIE0A);        // enable compare match interrupt
-    sei();
-    
-
+    hal_sweep_timer_init();
 }
 
-void start_sweep(void)
+void start_sweep(uint8_t mode)
 {
     /*
-    This function starts the linear sweep.
+    This function starts (or restarts) a FUNC_LIN_SWEEP or FUNC_LOG_SWEEP
+    sweep with the current settings. The sweep interrupt reads the mode and
+    everything calculate_sweep_delta() works out, so the timer is stopped
+    before any of it changes.
     */
 
+    hal_sweep_timer_stop();         // stop the timer while the sweep state is reset
+    sweep_mode = mode;
+    calculate_sweep_delta();
     AD9833_set_waveform(FUNC_SINE);
 
-    // save previous frequency
-    saved_frequency = frequency;
-    TCCR0B |= (1 << CS01);           // set clk/8 prescaler and start timer
+    sweep_restart();
+    freq_reg_select = 0;
+    AD9833_set_tw(sweep_tw, 0);
+    AD9833_select_freq_reg(0);
+    sweep_overruns = 0;
+    sweep_dither_acc = 0;
+    sweep_period_count = sweep_tb.postscale;
+    hal_sweep_timer_start(sweep_tb.clock_select, sweep_tb.compare);
     is_sweep_started = 1;
 }
 
 void stop_sweep(void)
 {
     /*
-    This function stops the linear sweep.
+    This function stops the linear or log sweep.
     */
 
-    TCCR0B &= ~(1 << CS01);         // fin
-    frequency = saved_frequency;    // restore last frequency
-    AD9833_set_freq(frequency, 0);
-    check_func_sel();
+    hal_sweep_timer_stop();         // fin
+    AD9833_set_freq(frequency, 0);  // restore last frequency
+    AD9833_select_freq_reg(0);
     check_disp_sel();
-    TCNT0 = 0x00;
     is_sweep_started = 0;
 }
 
+void start_stream(void)
+{
+    /*
+    This function starts playing samples streamed from the host. The front
+    panel settings are left in FREQ0/PHASE0 and selected, the stream plays
+    through the other registers.
+    */
+
+    AD9833_select_freq_reg(0);
+    AD9833_select_phase_reg(0);
+    mod_stream_start();
+    sched_after(TASK_REMOTE, STREAM_POLL_TICKS);
+}
+
+void start_modulation(void)
+{
+    /*
+    This function starts wavetable FM or PM of the front panel frequency and
+    phase, with the settings in libmodulation. It can be called while the
+    engine is running, to restart it with new settings.
+    */
+
+    // the engine interrupt writes the AD9833 through the same driver state
+    // (burst buffer, control word and tuning word caches), stop it first
+    mod_stop();
+    AD9833_set_freq(frequency, 0);
+    AD9833_select_freq_reg(0);
+    AD9833_set_phase(phase);
+    AD9833_select_phase_reg(0);
+    mod_wave_start(AD9833_freq_to_tw(frequency), phase);
+}
+
+void start_psk(void)
+{
+    /*
+    This function starts phase shift keying of the front panel frequency
+    and phase, with the settings in libmodulation.
+    */
+
+    mod_stop();
+    AD9833_set_freq(frequency, 0);
+    AD9833_select_freq_reg(0);
+    mod_psk_start(phase);
+}
+
+void start_fsk(void)
+{
+    /*
+    This function starts two tone FSK from the front panel frequency, with
+    the settings in libmodulation.
+    */
+
+    mod_stop();
+    AD9833_set_phase(phase);
+    AD9833_select_phase_reg(0);
+    mod_fsk_start(AD9833_freq_to_tw(frequency));
+}
+
+uint8_t start_hop(void)
+{
+    /*
+    This function starts frequency hopping through the list in
+    libmodulation. Returns false if the list is empty.
+    */
+
+    mod_stop();
+    AD9833_set_phase(phase);
+    AD9833_select_phase_reg(0);
+    return mod_hop_start();
+}
+
+void stop_modulation(void)
+{
+    /*
+    This function stops a stream, wavetable modulation or PSK and puts the
+    front panel frequency and phase back on the output.
+    */
+
+    mod_stop();
+    AD9833_set_freq(frequency, 0);
+    AD9833_select_freq_reg(0);
+    AD9833_set_phase(phase);
+    AD9833_select_phase_reg(0);
+    update_display();
+    sched_post(TASK_OUTPUT);        // the switch may have moved while locked out
+}
+
 void init_tick_timer(void)
 {
     /*
@@ -368,13 +531,7 @@ void init_tick_timer(void)
     It should be called just before main loop is entered.
     */
 
-    OCR1A = TICK_TIMER_OVF;                         // set overflow value for OC1A
-
-    cli();
-    TCNT1 = 0x00;                                   // ensure counter is reset
-    TIMSK1 = (1 << OCIE1A);                         // enable compare match interrupt
-    TCCR1B = (1 << WGM12) | (1 << CS12);            // set CTC mode and clk/256 prescaler, start the timer
-    sei();
+    hal_tick_timer_init(TICK_TIMER_OVF);
 }
 
 void toggle_debug_pin(void)
@@ -383,80 +540,313 @@ void toggle_debug_pin(void)
     This function was used for debugging.
     */
 
-    PORTD ^= (1 << PD5);            // pin 5
+    hal_debug_pin_toggle();
 }
 
-void check_rotary_encoder(void)
+uint32_t adjust_value(uint32_t value, int32_t change, uint32_t step)
 {
     /*
-    This function checks if the rotary encoder has moved. If so, update display.
+    This function adds change * step to a value, stopping at 0 or 0xFFFFFFFF
+    rather than wrapping. Tighter bounds are left to the caller.
     */
 
-    int8_t delta;
+    int64_t result = (int64_t)value + (int64_t)change * step;
 
-    // check if rotary encoder has moved
-    if (rot_enc_cw)
-        {
-            delta = 1;
-            rot_enc_cw = 0;
-        }
+    if (result < 0)
+    {
+        return 0;
+    }
+    if (result > 0xFFFFFFFFLL)
+    {
+        return 0xFFFFFFFFUL;
+    }
+    return result;
+}
 
-    else if (rot_enc_ccw)
-        {
-            delta = -1;
-            rot_enc_ccw = 0;
-        }
-    else
+void handle_event(const event_t *event)
+{
+    /*
+    This function passes an event from the queue on to the scheduler. Encoder
+    and pushbutton input is gathered and acted on by the next encoder task.
+    */
+
+    if (event->type == EVENT_TICK)
     {
-        delta = 0;
+        sched_tick();
     }
-    
+    else if (((event->type == EVENT_PRESS) || (event->type == EVENT_RELEASE)) && (event->arg & PANEL_OE))
+    {
+        sched_post(TASK_OUTPUT);
+    }
+    else if ((event->type == EVENT_SERIAL) || (event->type == EVENT_MODULATION))
+    {
+        sched_post(TASK_REMOTE);
+    }
+
+    if (event->type == EVENT_ENCODER)
+    {
+        rot_enc_detents += event->arg;
+    }
+    else if ((event->type == EVENT_PRESS) && (event->arg & PANEL_PB))
+    {
+        rot_enc_presses += 1;
+    }
+    else if ((event->type == EVENT_LONG_PRESS) && (event->arg & PANEL_PB))
+    {
+        rot_enc_long_press = 1;
+    }
+}
+
+void discard_input(void)
+{
+    /*
+    This function drops gathered front panel input, used while it is locked
+    out during a sweep.
+    */
+
+    rot_enc_detents = 0;
+    rot_enc_presses = 0;
+    rot_enc_long_press = 0;
+}
+
+void check_rotary_encoder(void)
+{
+    /*
+    This function checks if the rotary encoder has moved. If so, update display.
+    */
+
+    int16_t delta = rot_enc_detents;
+    int32_t change = rotary_encoder_accelerate(delta);
+    uint32_t new_phase;
+
+    rot_enc_detents = 0;
+
     // if rotary encoder has moved, update relevant variable and display
     if (delta)
     {
         if (disp_select_state == DISP_FREQ)
         {
-            frequency += delta * selected_digit_multiplier[selected_digit - 1];
+            // frequencies only have 7 digits, set to 7 if out of bounds
+            if (selected_digit > DIGITS_FREQ) selected_digit = DIGITS_FREQ;
+
+            frequency = adjust_value(frequency, change, selected_digit_multiplier[selected_digit - 1]);
             set_frequency();
         }
         else if (disp_select_state == DISP_PHASE)
         {
             // phase can only have 4 digits, set to 4 if out of bounds
-            if (selected_digit > 4) selected_digit = 4;
+            if (selected_digit > DIGITS_PHASE) selected_digit = DIGITS_PHASE;
 
-            phase += delta * selected_digit_multiplier[selected_digit - 1];
+            new_phase = adjust_value(phase, change, selected_digit_multiplier[selected_digit - 1]);
+            if (new_phase > MAX_PHASE)
+            {
+                new_phase = MAX_PHASE + 1;          // set_phase() wraps this to 0
+            }
+            phase = new_phase;
             set_phase(phase);
         }
         else if (disp_select_state == DISP_SWEEP_START)
         {
-            sweep_start_freq += delta * selected_digit_multiplier[selected_digit - 1];
+            if (selected_digit > DIGITS_FREQ) selected_digit = DIGITS_FREQ;
+
+            sweep_start_freq = adjust_value(sweep_start_freq, change, selected_digit_multiplier[selected_digit - 1]);
+            if (sweep_start_freq < 1)
+            {
+                sweep_start_freq = 1;
+            }
+            else if (sweep_start_freq > MAX_FREQ)
+            {
+                sweep_start_freq = MAX_FREQ;
+            }
             max7221_display_int(sweep_start_freq);
         }
         else if (disp_select_state == DISP_SWEEP_STOP)
         {
-            sweep_stop_freq += delta * selected_digit_multiplier[selected_digit - 1];
+            if (selected_digit > DIGITS_FREQ) selected_digit = DIGITS_FREQ;
+
+            sweep_stop_freq = adjust_value(sweep_stop_freq, change, selected_digit_multiplier[selected_digit - 1]);
+            if (sweep_stop_freq < 1)
+            {
+                sweep_stop_freq = 1;
+            }
+            else if (sweep_stop_freq > MAX_FREQ)
+            {
+                sweep_stop_freq = MAX_FREQ;
+            }
             max7221_display_int(sweep_stop_freq);
         }
         else if (disp_select_state == DISP_SWEEP_TIME)
         {
-            // bounds checking
-            int8_t new_sweep_interval = sweep_interval + delta;
-            if (new_sweep_interval > SWEEP_2000MS)
+            sweep_time = adjust_value(sweep_time, change, selected_digit_multiplier[selected_digit - 1]);
+            if (sweep_time < SWEEP_TIME_MIN)
             {
-                sweep_interval = SWEEP_2000MS;
+                sweep_time = SWEEP_TIME_MIN;
             }
-            else if (new_sweep_interval < SWEEP_50MS)
+            else if (sweep_time > SWEEP_TIME_MAX)
             {
-                sweep_interval = SWEEP_50MS;
-            }
-            else
-            { 
-                sweep_interval += delta;
+                sweep_time = SWEEP_TIME_MAX;
             }
+            max7221_display_int(sweep_time);
+        }
+    }
+}
+
+void check_output_enable(void)
+{
+    /*
+    This function puts the AD9833 to sleep or wakes it to follow the output
+    enable switch. It is run when the switch changes, and is locked out
+    during a sweep or stream.
+    */
+
+    if (is_sweep_started || mod_active())
+    {
+        return;
+    }
+
+    if (!(panel_state() & PANEL_OE) && !(is_ad9833_asleep))
+    {
+        AD9833_sleep(1);
+        is_ad9833_asleep = 1;
+    }
+    else if ((panel_state() & PANEL_OE) && is_ad9833_asleep)
+    {
+        AD9833_sleep(0);
+        AD9833_reset(0);
+        check_func_sel();
+        is_ad9833_asleep = 0;
+    }
+}
+
+void init_tasks(void)
+{
+    /*
+    This function registers the main loop tasks with the scheduler.
+    */
+
+    sched_add(TASK_ENCODER, task_encoder, 1);
+    sched_add(TASK_REMOTE, task_remote, 0);
+    sched_add(TASK_OUTPUT, check_output_enable, 0);
+    sched_add(TASK_DISPLAY, task_display, 1);
+    sched_add(TASK_SELECTORS, task_selectors, 1);
+    sched_add(TASK_SETTINGS, task_settings, SETTINGS_POLL_TICKS);
+    sched_post(TASK_OUTPUT);                // follow the switch as it was at power up
+}
+
+void task_encoder(void)
+{
+    /*
+    This task acts on the encoder and pushbutton input gathered over the last
+    tick. Input is locked out while sweeping or streaming.
+    */
 
-            update_display();
+    // the first input during the boot display only skips it
+    if ((boot_stage != BOOT_DONE) && (rot_enc_detents || rot_enc_presses || rot_enc_long_press))
+    {
+        discard_input();
+        skip_boot_display();
+    }
+
+    if (is_sweep_started || mod_active())
+    {
+        discard_input();
+        return;
+    }
+
+    check_rotary_encoder();
+    check_rot_enc_pb();
+}
+
+void task_remote(void)
+{
+    /*
+    This task carries out remote commands from the UART. It takes one line
+    per run, so more urgent tasks get in between lines. While a stream is
+    playing it also looks every few ticks to see if it has ended.
+    */
+
+    skip_boot_display();
+
+    if (remote_poll())
+    {
+        sched_post(TASK_REMOTE);
+    }
+    else if (mod_active())
+    {
+        if (mod_poll())
+        {
+            stop_modulation();
+        }
+        else
+        {
+            sched_after(TASK_REMOTE, STREAM_POLL_TICKS);
         }
     }
+    max7221_commit();
+}
+
+void task_display(void)
+{
+    /*
+    This task steps the boot display, or flashes the selected digit, and
+    sends any display changes.
+    */
+
+    if (boot_stage != BOOT_DONE)
+    {
+        check_boot_display();
+    }
+    else
+    {
+        check_digit_flash();
+    }
+    max7221_commit();
+}
+
+void task_selectors(void)
+{
+    /*
+    This task follows the function and display select controls. Display
+    select is locked out while sweeping, and the output enable switch is
+    looked at again once a sweep ends. Both are locked out while streaming.
+    */
+
+    uint8_t was_sweeping = is_sweep_started;
+
+    update_selectors();
+    if (mod_active())
+    {
+        return;
+    }
+    if ((boot_stage != BOOT_DONE) && ((read_func_sel() != func_select_panel) || (read_disp_sel() != disp_select_state)))
+    {
+        skip_boot_display();
+    }
+    check_func_sel();
+    if (!is_sweep_started)
+    {
+        check_disp_sel();
+    }
+    if (was_sweeping && !is_sweep_started)
+    {
+        sched_post(TASK_OUTPUT);
+    }
+    max7221_commit();
+}
+
+void task_settings(void)
+{
+    /*
+    This task saves the settings to EEPROM once they have settled. Nothing is
+    started while sweeping or modulating, so the EEPROM interrupt stays off
+    the timer paths. The front panel is locked out then anyway.
+    */
+
+    if (is_sweep_started || mod_active())
+    {
+        return;
+    }
+    settings_poll();
 }
 
 void set_phase(uint16_t new_phase)
@@ -487,8 +877,7 @@ void init_debug_pin(void)
     Used for debugging.
     */
 
-    DDRD |= (1 << PD5);
-    PORTD &= ~(1 << PD5);
+    hal_debug_pin_init();
 }
 
 void update_display(void)
@@ -519,96 +908,369 @@ void update_display(void)
 
     else if (disp_select_state == DISP_SWEEP_TIME)
     {
-        max7221_display_int(sweep_times[sweep_interval]);
+        max7221_display_int(sweep_time);
     }
 }
 
-void calculate_sweep_delta(void)
+uint8_t _lf_clz(uint32_t x)
 {
     /*
-    This function calculated the step increase for linear sweep.
+    This function returns the number of leading zero bits in x (x must be non-zero).
     */
 
-    uint32_t sweep_step;
-    
-    if (sweep_interval == SWEEP_50MS)
+    uint8_t n = 0;
+
+    while (!(x & 0x80000000UL))
     {
-        sweep_step = SWEEP_STEPS_50MS;
+        x <<= 1;
+        n++;
     }
-    else if (sweep_interval == SWEEP_100MS)
+    return n;
+}
+
+void _lf_mul(uint32_t *m, int32_t *e, uint32_t bm, int32_t be)
+{
+    /*
+    This function multiplies two normalised unsigned numbers of the form
+    (m / 2^31) * 2^e, where m has its top bit set. Used to work out the log
+    sweep ratio without pow() or log().
+    */
+
+    uint64_t p = (uint64_t)(*m) * bm;
+
+    if (p & 0x8000000000000000ULL)
     {
-        sweep_step = SWEEP_STEPS_100MS;
+        *m = p >> 32;
+        *e = *e + be + 1;
     }
-    else if (sweep_interval == SWEEP_250MS)
+    else
     {
-        sweep_step = SWEEP_STEPS_250MS;
+        *m = p >> 31;
+        *e = *e + be;
     }
-    else if (sweep_interval == SWEEP_500MS)
+}
+
+uint8_t _log_ratio_overshoots(uint32_t ratio, uint8_t octaves, uint32_t steps)
+{
+    /*
+    This function returns true if start * (2^octaves * (1 + ratio / 2^32))^steps
+    is past the sweep stop tuning word, or start * (2^-octaves * (1 - ratio /
+    2^32))^steps is below it for a descending sweep (ratio no more than 2^31).
+    */
+
+    uint32_t m = sweep_start_tw << _lf_clz(sweep_start_tw);
+    int32_t e = 31 - _lf_clz(sweep_start_tw);
+    uint32_t rm = 0x80000000UL | (ratio >> 1);
+    int32_t re = octaves;
+
+    if (sweep_descending)
     {
-        sweep_step = SWEEP_STEPS_500MS;
+        re = -(int32_t)octaves;
+        if (ratio)
+        {
+            rm = 0 - ratio;                 // 2^32 - ratio, top bit set
+            re -= 1;
+        }
     }
-    else if (sweep_interval == SWEEP_1000MS)
+    uint32_t stop_m = sweep_stop_tw << _lf_clz(sweep_stop_tw);
+    int32_t stop_e = 31 - _lf_clz(sweep_stop_tw);
+
+    // start * ratio^steps by repeated squaring. With up to SWEEP_MAX_STEPS
+    // steps the exponents of a bad guess grow far past 16 bits, but the
+    // product only moves one way, so stop once it is a whole octave past
+    while (steps)
     {
-        sweep_step = SWEEP_STEPS_1000MS;
+        if (steps & 1)
+        {
+            _lf_mul(&m, &e, rm, re);
+            if (sweep_descending ? (e < stop_e) : (e > stop_e))
+            {
+                return 1;
+            }
+        }
+        steps >>= 1;
+        if (steps)
+        {
+            _lf_mul(&rm, &re, rm, re);
+        }
     }
-    else if (sweep_interval == SWEEP_2000MS)
+
+    if (sweep_descending)
     {
-        sweep_step = SWEEP_STEPS_2000MS;
+        if (e != stop_e)
+        {
+            return (e < stop_e);
+        }
+        return (m < stop_m);
     }
-    sweep_delta = (sweep_stop_freq - sweep_start_freq) / sweep_step;
+    if (e != stop_e)
+    {
+        return (e > stop_e);
+    }
+    return (m > stop_m);
 }
 
-void sweep_increment(void)
+void calculate_log_ratio(void)
+{
+    /*
+    This function finds the fixed point per step multiplier for the log sweep
+    by bisection, so each step in the interrupt is a single 32x32 multiply.
+    Only called when a sweep is started.
+    */
+
+    uint32_t lo = 0;
+    uint32_t hi = sweep_descending ? 0x80000000UL : 0xFFFFFFFFUL;    // no more than 2x or 1/2x a step
+
+    // short sweeps over a wide range move more than 2x a step, the whole
+    // octaves are a shift in the interrupt and the ratio covers the rest
+    sweep_log_octaves = 0;
+    while (!_log_ratio_overshoots(0, sweep_log_octaves + 1, sweep_steps - 1))
+    {
+        sweep_log_octaves += 1;
+    }
+
+    while (hi - lo > 1)
+    {
+        uint32_t mid = lo + ((hi - lo) >> 1);
+
+        if (_log_ratio_overshoots(mid, sweep_log_octaves, sweep_steps - 1))
+        {
+            hi = mid;
+        }
+        else
+        {
+            lo = mid;
+        }
+    }
+
+    // going up the ratio is modelled without its bottom bit, an odd one
+    // would be a little more than modelled and run past the stop
+    sweep_log_ratio = sweep_descending ? lo : (lo & ~1UL);
+}
+
+void sweep_plan(uint32_t time_ms, sweep_timebase_t *tb)
 {
     /*
-    This function increments the linear sweep by the sweep delta.
+    This function works out how TIMER0 should run a sweep of time_ms. Steps
+    are as short as SWEEP_STEP_MIN_CYCLES allows, until there would be more
+    than SWEEP_MAX_STEPS. The smallest prescaler that can count a step in one
+    period is used, steps too long even for clk/1024 take several periods.
+    The rounding left over is spread through the sweep by making some periods
+    one count longer, so a sweep is within half a prescaler tick of time_ms
+    (0.25us up to about 2 minutes, never more than 32us) and the steps are
+    within a count of each other.
     */
 
-    frequency += sweep_delta;
+    uint64_t cycles = (uint64_t)time_ms * (F_CPU / 1000UL);
+    uint64_t counts;
+    uint32_t prescale;
+    uint32_t steps;
+    uint8_t i = 0;
+
+    steps = (cycles / SWEEP_STEP_MIN_CYCLES < SWEEP_MAX_STEPS) ? (cycles / SWEEP_STEP_MIN_CYCLES) : SWEEP_MAX_STEPS;
+    if (steps < SWEEP_MIN_STEPS)
+    {
+        steps = SWEEP_MIN_STEPS;
+    }
 
-    // check if we have hit the sweep stop frequency
-    if (frequency > sweep_stop_freq)
+    while (1)
     {
-        frequency = sweep_start_freq;
+        prescale = pgm_read_word(&_sweep_prescale[i]);
+        counts = (cycles + (prescale / 2)) / prescale;
+
+        if ((counts <= (uint64_t)SWEEP_TIMER_COUNTS * steps) || (i == (SWEEP_PRESCALERS - 1)))
+        {
+            break;
+        }
+        i++;
     }
 
-    AD9833_set_freq(frequency, freq_reg_select);
+    tb->steps = steps;
+    tb->clock_select = SWEEP_CS_FIRST + i;
+    tb->postscale = (counts + ((uint64_t)SWEEP_TIMER_COUNTS * steps) - 1) / ((uint64_t)SWEEP_TIMER_COUNTS * steps);
+    tb->periods = steps * tb->postscale;
+    tb->compare = (counts / tb->periods) - 1;
+    tb->extra = counts % tb->periods;
+    tb->cycles = counts * prescale;
+}
+
+void calculate_sweep_delta(void)
+{
+    /*
+    This function calculates the step increase for the linear sweep, or the
+    step ratio for the log sweep.
+    */
+
+    sweep_plan(sweep_time, &sweep_tb);
+    sweep_steps = sweep_tb.steps;
+
+    // everything the sweep interrupt needs is worked out here, once
+    sweep_start_tw = AD9833_freq_to_tw(sweep_start_freq);
+    sweep_stop_tw = AD9833_freq_to_tw(sweep_stop_freq);
+
+    if (sweep_start_tw == 0)
+    {
+        sweep_start_tw = 1;
+    }
+    if (sweep_stop_tw == 0)
+    {
+        sweep_stop_tw = 1;                  // the log sweep needs both above 0
+    }
 
-    if (freq_reg_select)
+    // step 0 is the start and step (sweep_steps - 1) is the stop
+    if (sweep_stop_tw >= sweep_start_tw)
     {
-        AD9833_set_ctrl_reg(FSELECT);
+        sweep_descending = 0;
+        sweep_delta_fp = ((uint64_t)(sweep_stop_tw - sweep_start_tw) << 32) / (sweep_steps - 1);
     }
     else
     {
-        AD9833_set_ctrl_reg(0x00);
+        sweep_descending = 1;
+        sweep_delta_fp = ((uint64_t)(sweep_start_tw - sweep_stop_tw) << 32) / (sweep_steps - 1);
     }
+
+    sweep_log_ratio = 0;
+    sweep_log_octaves = 0;
+    if ((sweep_mode == FUNC_LOG_SWEEP) && (sweep_stop_tw != sweep_start_tw))
+    {
+        calculate_log_ratio();
+    }
+}
+
+void sweep_restart(void)
+{
+    /*
+    This function puts the sweep back to its start frequency.
+    */
+
+    sweep_tw = sweep_start_tw;
+    sweep_step_count = 0;
+    sweep_acc_fp = (uint64_t)sweep_start_tw << 32;
+    sweep_log_shift = _lf_clz(sweep_start_tw);
+    sweep_log_m = sweep_start_tw << sweep_log_shift;
 }
 
-ISR(INT0_vect)
+uint32_t sweep_log_tw(uint32_t m, uint8_t shift)
 {
     /*
-    Rotary encoder pushbutton interrupt.
+    This function rounds a log sweep mantissa back to a tuning word. The sum
+    is done in 64 bits, it can carry past bit 31 when m is near the top.
     */
 
-    rot_enc_pb = 1;
-    _delay_ms(20);
+    return (uint32_t)(((uint64_t)m + ((uint64_t)1 << (shift - 1))) >> shift);
+}
+
+uint8_t sweep_next_period(void)
+{
+    /*
+    This function is called from the sweep timer interrupt as each period
+    starts. It sets how long the period is, one count longer for
+    sweep_tb.extra of every sweep_tb.periods, and returns true when it is
+    time for a step.
+    */
+
+    sweep_dither_acc += sweep_tb.extra;
+    if (sweep_dither_acc >= sweep_tb.periods)
+    {
+        sweep_dither_acc -= sweep_tb.periods;
+        hal_sweep_timer_compare(sweep_tb.compare + 1);
+    }
+    else
+    {
+        hal_sweep_timer_compare(sweep_tb.compare);
+    }
+
+    if (--sweep_period_count)
+    {
+        return 0;
+    }
+    sweep_period_count = sweep_tb.postscale;
+    return 1;
 }
 
-ISR(INT1_vect)
+void sweep_increment(void)
 {
     /*
-    rotary encoder interrupt.
+    This function increments the sweep by one step. It is called from the
+    sweep timer interrupt, the new tuning word goes into the inactive frequency
+    register which is then selected.
     */
 
-    if (ROT_ENC_PIN & (1 << ROT_ENC_D1))
+    sweep_step_count += 1;
+
+    if (sweep_step_count >= sweep_steps)
     {
-        rot_enc_cw = 1;
+        sweep_restart();
+    }
+    else if (sweep_mode == FUNC_LOG_SWEEP)
+    {
+        uint64_t next;
+
+        // keep the top bit set so there is always 32 bits of precision
+        if (sweep_descending)
+        {
+            next = (uint64_t)sweep_log_m - (((uint64_t)sweep_log_m * sweep_log_ratio) >> 32);
+            if (!(next & 0x80000000UL))
+            {
+                next <<= 1;
+                sweep_log_shift += 1;
+            }
+            sweep_log_shift += sweep_log_octaves;
+        }
+        else
+        {
+            next = (uint64_t)sweep_log_m + (((uint64_t)sweep_log_m * sweep_log_ratio) >> 32);
+            if (next & 0x100000000ULL)
+            {
+                next >>= 1;
+                sweep_log_shift -= 1;
+            }
+            sweep_log_shift -= sweep_log_octaves;
+        }
+        sweep_log_m = next;
+        sweep_tw = sweep_log_tw(sweep_log_m, sweep_log_shift);
+
+        if (sweep_step_count == (sweep_steps - 1))
+        {
+            // land exactly on the stop frequency
+            sweep_endpoint_error = (int32_t)sweep_tw - (int32_t)sweep_stop_tw;
+            sweep_tw = sweep_stop_tw;
+        }
     }
     else
     {
-        rot_enc_ccw = 1;
+        if (sweep_step_count == (sweep_steps - 1))
+        {
+            sweep_tw = sweep_stop_tw;
+        }
+        else
+        {
+            if (sweep_descending)
+            {
+                sweep_acc_fp -= sweep_delta_fp;
+            }
+            else
+            {
+                sweep_acc_fp += sweep_delta_fp;
+            }
+            sweep_tw = (sweep_acc_fp + 0x80000000UL) >> 32;
+        }
+    }
+
+    // if the last step is still waiting for the SPI bus, drop this write so the
+    // sweep keeps to the timer
+    if (spi_queued(SPI_PRIO_HIGH))
+    {
+        sweep_overruns += 1;
+        return;
     }
-    _delay_ms(20);
+
+    // write the inactive register and select it, under one FSYNC
+    freq_reg_select ^= (1 << 0);
+    AD9833_burst_begin();
+    AD9833_set_tw(sweep_tw, freq_reg_select);
+    AD9833_select_freq_reg(freq_reg_select);
+    AD9833_burst_end();
 }
 
 ISR(TIMER1_COMPA_vect)
@@ -617,15 +1279,21 @@ ISR(TIMER1_COMPA_vect)
     Main tick timer interrupt.
     */
 
-    tick_flag = 1;
+    event_tick_count += 1;
+    panel_sample();
+    event_put(EVENT_TICK, 0);
 }
 
 ISR(TIMER0_COMPA_vect)
 {
     /*
-    Sweep timer interrupt.
+    Sweep timer interrupt, a step is taken every sweep_tb.postscale periods.
     */
-   
-    freq_reg_select ^= (1 << 0);
-    sweep_increment_trig = 1;
+
+    if (sweep_next_period())
+    {
+        HAL_BENCH_BEGIN(sweep_increment);
+        sweep_increment();
+        HAL_BENCH_END(sweep_increment);
+    }
 }
\ No newline at end of file
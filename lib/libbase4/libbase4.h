@@ -18,40 +18,85 @@
 #ifndef LIBBASE4_H
 #define LIBBASE4_H
 
-// the following sets the number of steps for each sweep time interval
-
-#define SWEEP_STEPS_50MS        500UL
-#define SWEEP_STEPS_100MS       1000UL
-#define SWEEP_STEPS_250MS       2500UL
-#define SWEEP_STEPS_500MS       5000UL
-#define SWEEP_STEPS_1000MS      10000UL
-#define SWEEP_STEPS_2000MS      20000UL
-
-#define SWEEP_50MS              0
-#define SWEEP_100MS             1
-#define SWEEP_250MS             2
-#define SWEEP_500MS             3
-#define SWEEP_1000MS            4
-#define SWEEP_2000MS            5
+#include "libevent.h"
+
+// sweeps step every SWEEP_STEP_MIN_CYCLES until they would need more than
+// SWEEP_MAX_STEPS, longer ones take longer steps. See sweep_plan()
+
+#define SWEEP_MIN_STEPS         2
+#define SWEEP_MAX_STEPS         1000000UL   // about 100s at the fastest step
+#define SWEEP_TIMER_COUNTS      255UL       // most counts in a period, leaving one for dithering
+#define SWEEP_PRESCALERS        4           // clk/8 to clk/1024
+#define SWEEP_CS_FIRST          2           // CS0 bits for clk/8
+
+// main loop tasks, most urgent first. The sweep steps themselves run in the
+// TIMER0 interrupt, ahead of all of these
+#define TASK_ENCODER            0
+#define TASK_REMOTE             1
+#define TASK_OUTPUT             2
+#define TASK_DISPLAY            3
+#define TASK_SELECTORS          4
+#define TASK_SETTINGS           5
+
+#define STREAM_POLL_TICKS       4           // how often the remote task looks at a running stream
+
+// startup. The output is set up first, then the lamp test and splash screen
+// run from the display task for these many ticks each (0 leaves one out).
+// Any front panel or remote input cuts them short. Power on to valid output
+// is BOOT_SETTLE_MS and the setup words on the SPI bus (about 10.2 ms
+// together in the native build), plus the CPU time of settings_load() and
+// initial_setup(), which has not been measured on the AVR yet. make boot in
+// tools/bench gives the whole figure and fails if it is over 20 ms
+#define BOOT_SETTLE_MS          10          // for the supplies, before anything is sent
+#define BOOT_LAMP_TEST_TICKS    33          // about 1 s
+#define BOOT_SPLASH_TICKS       100         // about 3 s
+
+#define BOOT_LAMP_TEST          0
+#define BOOT_SPLASH             1
+#define BOOT_DONE               2
+
+// digits the encoder can step, counted from the right. The sweep time needs
+// all 8 (SWEEP_TIME_MAX), a frequency 7 and the phase 4
+#define DIGITS_SWEEP_TIME       8
+#define DIGITS_FREQ             7
+#define DIGITS_PHASE            4
+
+// how TIMER0 runs a sweep
+typedef struct
+{
+    uint32_t steps;                 // steps per sweep
+    uint32_t periods;               // timer periods per sweep, steps * postscale
+    uint32_t extra;                 // periods per sweep that are one count longer
+    uint16_t postscale;             // timer periods per step
+    uint8_t clock_select;           // CS0 bits
+    uint8_t compare;                // OCR0A, before dithering
+    uint64_t cycles;                // CPU cycles a sweep really takes
+} sweep_timebase_t;
 
 extern uint32_t frequency;
 extern uint16_t phase;
 extern uint8_t func_select_state;
+extern uint8_t func_select_panel;
 extern uint8_t disp_select_state;
-extern volatile uint8_t rot_enc_cw;
-extern volatile uint8_t rot_enc_ccw;
 extern uint32_t sweep_start_freq;
 extern uint32_t sweep_stop_freq;
-extern uint32_t sweep_interval;              // from 0 to 9 (the index to the array of possible sweep time intervals)
-uint8_t selected_digit;              // from 1 to 7
-extern volatile uint8_t tick_flag;
-extern volatile uint8_t rot_enc_pb;
+extern uint32_t sweep_time;                  // ms, SWEEP_TIME_MIN to SWEEP_TIME_MAX
+extern sweep_timebase_t sweep_tb;
+extern uint8_t sweep_mode;
+extern uint8_t is_sweep_started;
+extern volatile uint16_t sweep_overruns;
+extern int32_t sweep_endpoint_error;
+extern uint8_t selected_digit;       // from 1 to DIGITS_SWEEP_TIME
+extern uint8_t boot_stage;
 //uint32_t selected_digit_multiplier[8];
 
 // prototypes
 
-void spi_init(void);
 void initial_setup(void);
+void start_boot_display(void);
+void boot_display_stage(uint8_t stage);
+void check_boot_display(void);
+void skip_boot_display(void);
 
 void set_frequency(void);
 
@@ -61,8 +106,14 @@ void check_disp_sel(void);
 void init_sweep_timer(void);
 void init_tick_timer(void);
 
-void start_sweep();
+void start_sweep(uint8_t mode);
 void stop_sweep();
+void start_stream(void);
+void start_modulation(void);
+void start_psk(void);
+void start_fsk(void);
+uint8_t start_hop(void);
+void stop_modulation(void);
 
 void toggle_debug_pin(void);
 
@@ -70,13 +121,32 @@ void update_display(void);
 void set_phase(uint16_t new_phase);
 void init_debug_pin(void);
 
+void update_selectors(void);
 uint8_t read_func_sel(void);
 uint8_t read_disp_sel(void);
 void set_initial_func_sel_state(void);
+void set_initial_disp_sel_state(void);
 void update_display(void);
+uint32_t adjust_value(uint32_t value, int32_t change, uint32_t step);
+void handle_event(const event_t *event);
+void discard_input(void);
 void check_rotary_encoder(void);
+void check_output_enable(void);
 
+void init_tasks(void);
+void task_encoder(void);
+void task_remote(void);
+void task_display(void);
+void task_selectors(void);
+void task_settings(void);
+
+void sweep_plan(uint32_t time_ms, sweep_timebase_t *tb);
 void calculate_sweep_delta(void);
+void calculate_log_ratio(void);
+void sweep_restart(void);
+uint8_t _lf_clz(uint32_t x);
+uint32_t sweep_log_tw(uint32_t m, uint8_t shift);
+uint8_t sweep_next_period(void);
 void sweep_increment(void);
 
 void check_rot_enc_pb(void);
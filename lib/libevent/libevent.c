@@ -0,0 +1,171 @@
+/* 
+ * This file is part of the BASE-4 distribution (website).
+ * Copyright (c) 2018 Tim Buchanan.
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "hal.h"
+#include "libevent.h"
+
+event_t _event_queue[EVENT_QUEUE_LEN];
+volatile uint8_t _event_head = 0;           // next slot to write, producer only
+volatile uint8_t _event_tail = 0;           // next slot to read, consumer only
+volatile uint8_t _event_high_water = 0;     // most events waiting at once
+volatile uint16_t _event_drops = 0;         // events lost because the queue was full
+volatile uint16_t event_tick_count = 0;     // advanced by the tick interrupt
+
+void event_put(uint8_t type, int8_t arg)
+{
+    /*
+    This function queues an event. Only call it from interrupt context. If
+    the queue is full the event is dropped and counted.
+    */
+
+    uint8_t head = _event_head;
+    uint8_t next = (head + 1) & (EVENT_QUEUE_LEN - 1);
+    uint8_t depth;
+
+    if (next == _event_tail)
+    {
+        _event_drops += 1;
+        return;
+    }
+
+    _event_queue[head].type = type;
+    _event_queue[head].arg = arg;
+    _event_queue[head].tick = event_tick_count;
+    _event_head = next;                     // publish only once the slot is written
+
+    depth = (next - _event_tail) & (EVENT_QUEUE_LEN - 1);
+    if (depth > _event_high_water)
+    {
+        _event_high_water = depth;
+    }
+}
+
+uint8_t event_get(event_t *event)
+{
+    /*
+    This function takes the oldest event off the queue. Returns false if the
+    queue is empty.
+    */
+
+    uint8_t tail = _event_tail;
+
+    if (tail == _event_head)
+    {
+        return 0;
+    }
+
+    *event = _event_queue[tail];
+    _event_tail = (tail + 1) & (EVENT_QUEUE_LEN - 1);  // free the slot only once it is copied
+    return 1;
+}
+
+uint8_t event_depth(void)
+{
+    /*
+    This function returns how many events are waiting.
+    */
+
+    return (_event_head - _event_tail) & (EVENT_QUEUE_LEN - 1);
+}
+
+void event_wait(void)
+{
+    /*
+    This function sleeps the CPU until there is an event to handle. Other
+    interrupts (SPI, ADC, sweep steps) wake it too, it goes straight back to
+    sleep if they queued nothing. The queue is checked with interrupts off so
+    an event can't arrive between the check and the sleep.
+    */
+
+    while (1)
+    {
+        cli();
+        if (_event_tail != _event_head)
+        {
+            sei();
+            return;
+        }
+        hal_sleep();
+    }
+}
+
+uint32_t event_now(void)
+{
+    /*
+    This function returns a timestamp for event_us_since(). It can be called
+    from interrupt context.
+    */
+
+    uint16_t ticks = 0;
+    uint16_t count = 0;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        ticks = event_tick_count;
+        count = hal_tick_timer_count();
+
+        // the counter has wrapped but the tick interrupt hasn't run yet
+        if (hal_tick_timer_pending() && (count < (TICK_TIMER_OVF / 2)))
+        {
+            ticks += 1;
+        }
+    }
+    return ((uint32_t)ticks << 16) | count;
+}
+
+uint32_t event_us_since(uint32_t stamp)
+{
+    /*
+    This function returns the microseconds from a timestamp until now, to the
+    nearest TIMER1 count. Good for about half an hour.
+    */
+
+    uint32_t now = event_now();
+    uint16_t ticks = (now >> 16) - (stamp >> 16);
+    int32_t counts = (int32_t)ticks * (TICK_TIMER_OVF + 1) + (uint16_t)now - (uint16_t)stamp;
+
+    if (counts < 0)
+    {
+        return 0;
+    }
+    return (uint32_t)counts * EVENT_COUNT_US;
+}
+
+uint8_t event_high_water(void)
+{
+    return _event_high_water;
+}
+
+uint16_t event_drops(void)
+{
+    uint16_t drops = 0;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        drops = _event_drops;
+    }
+    return drops;
+}
+
+void event_reset_stats(void)
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        _event_high_water = event_depth();
+        _event_drops = 0;
+    }
+}
@@ -0,0 +1,63 @@
+/* 
+ * This file is part of the BASE-4 distribution (website).
+ * Copyright (c) 2018 Tim Buchanan.
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef LIBEVENT_H
+#define LIBEVENT_H
+
+// Event queue from the interrupt handlers to the main loop. Handlers don't
+// nest, so together they are the single producer and the main loop is the
+// single consumer. Each index is only written by one side, so no locking
+// is needed. event_put() must only be called from interrupt context.
+
+#define EVENT_QUEUE_LEN         32          // must be a power of 2
+
+// event types
+#define EVENT_NONE              0
+#define EVENT_TICK              1           // arg unused
+#define EVENT_ENCODER           2           // arg = detents, positive clockwise
+#define EVENT_PRESS             3           // arg = PANEL_ inputs that turned on
+#define EVENT_RELEASE           4           // arg = PANEL_ inputs that turned off
+#define EVENT_LONG_PRESS        5           // arg = PANEL_ inputs held
+#define EVENT_SERIAL            6           // arg unused, a command line has arrived on the UART
+#define EVENT_MODULATION        7           // arg unused, the modulation engine has stopped
+
+// timestamps, the tick count in the top 16 bits and the TIMER1 count in the
+// bottom 16. TIMER1 counts at clk/256.
+#define EVENT_COUNT_US          16
+
+typedef struct
+{
+    uint8_t type;
+    int8_t arg;
+    uint16_t tick;                          // tick count when the event was queued
+} event_t;
+
+extern volatile uint16_t event_tick_count;
+
+// prototypes
+
+void event_put(uint8_t type, int8_t arg);
+uint8_t event_get(event_t *event);
+uint8_t event_depth(void);
+void event_wait(void);
+uint32_t event_now(void);
+uint32_t event_us_since(uint32_t stamp);
+uint8_t event_high_water(void);
+uint16_t event_drops(void);
+void event_reset_stats(void);
+
+#endif /* LIBEVENT_H */
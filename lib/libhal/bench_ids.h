@@ -0,0 +1,48 @@
+/* 
+ * This file is part of the BASE-4 distribution (website).
+ * Copyright (c) 2018 Tim Buchanan.
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef BENCH_IDS_H
+#define BENCH_IDS_H
+
+/************************************************************************
+* Benchmark points. Built with BASE4_BENCH the firmware writes the id to
+* GPIOR0 on entry and id | BENCH_END on exit, tools/bench times them under
+* simavr. Interrupt handlers are timed from their vectors so they need no
+* markers. Shared by the firmware and the runner, keep ids below 0x80.
+************************************************************************/
+
+#define BENCH_END               0x80
+
+#define BENCH_POINTS(X) \
+    X(1, AD9833_set_freq) \
+    X(2, sweep_increment) \
+    X(3, set_frequency) \
+    X(4, max7221_display_int) \
+    X(5, check_func_sel) \
+    X(6, tick) \
+    X(7, mod_step) \
+    X(8, mod_sample) \
+    X(9, boot)
+
+#define BENCH_ENUM(id, name)    BENCH_##name = id,
+
+enum
+{
+    BENCH_POINTS(BENCH_ENUM)
+};
+
+#endif /* BENCH_IDS_H */
@@ -0,0 +1,478 @@
+/* 
+ * This file is part of the BASE-4 distribution (website).
+ * Copyright (c) 2018 Tim Buchanan.
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef HAL_H
+#define HAL_H
+
+/************************************************************************
+* Thin hardware abstraction layer. Every register access made by the
+* drivers goes through here. On the AVR these are static inline wrappers
+* around the registers, so they cost nothing. When built with BASE4_NATIVE
+* they are implemented by hal_sim.c, which simulates the timers, ADC, pins,
+* EEPROM and SPI bus, and decodes SPI frames into AD9833 and MAX7221 models.
+************************************************************************/
+
+#include "bench_ids.h"
+
+#ifndef BASE4_NATIVE
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+#include <avr/sleep.h>
+#include <util/atomic.h>
+#include <util/delay.h>
+#include "globals.h"
+
+#ifdef BASE4_BENCH
+#define HAL_BENCH_BEGIN(name)   (GPIOR0 = BENCH_##name)
+#define HAL_BENCH_END(name)     (GPIOR0 = BENCH_##name | BENCH_END)
+#else
+#define HAL_BENCH_BEGIN(name)   ((void)0)
+#define HAL_BENCH_END(name)     ((void)0)
+#endif
+
+static inline void hal_init(void)
+{
+    set_sleep_mode(SLEEP_MODE_IDLE);        // timers, SPI and ADC keep running
+    PRR |= (1 << PRTWI);                    // TWI is never used
+}
+
+static inline void hal_idle(void)
+{
+}
+
+static inline void hal_sleep(void)
+{
+    // call with interrupts disabled. The instruction after sei always runs
+    // before any interrupt, so one that is already pending wakes the sleep
+    // rather than being taken just before it.
+    sleep_enable();
+    sei();
+    sleep_cpu();
+    sleep_disable();
+}
+
+static inline uint8_t hal_irq_enabled(void)
+{
+    return (SREG & (1 << SREG_I)) != 0;
+}
+
+// SPI
+
+static inline void hal_spi_init(void)
+{
+    // set output pins. NOTE: SS Must be set as output even though not used!!!
+    SPI_DDR |= (1 << SPI_SCK) | (1 << SPI_MOSI) | (1 << MAX7221_CS) | (1 << SPI_SS);
+
+    // set outputs
+    SPI_PORT &= ~(1 << SPI_SS);
+    SPI_PORT |= (1 << MAX7221_CS) | (1 << SPI_SCK);
+    AD9833_DDR |= (1 << AD9833_CS);
+    AD9833_PORT |= (1 << AD9833_CS);
+
+    // enable SPI and its interrupt, master mode CPOL = 1, frequency = 8 MHz
+    SPCR |= (1 << SPIE) | (1 << SPE) | (1 << MSTR) | (1 << CPOL);
+    SPSR |= (1 << SPI2X);
+}
+
+static inline void hal_spi_set_mode(uint8_t mode)
+{
+    SPCR = (SPCR & ~((1 << CPOL) | (1 << CPHA))) | mode;
+}
+
+static inline void hal_spi_write(uint8_t data)
+{
+    SPDR = data;
+}
+
+static inline uint8_t hal_spi_done(void)
+{
+    return (SPSR & (1 << SPIF)) != 0;
+}
+
+static inline void hal_cs_assert(uint8_t cs)
+{
+    SPI_PORT &= ~cs;                // NOTE: all chip selects are on SPI_PORT
+}
+
+static inline void hal_cs_release(uint8_t cs)
+{
+    SPI_PORT |= cs;
+}
+
+// ADC
+
+static inline void hal_adc_init(void)
+{
+    // set ADC ref = Vcc
+    ADMUX |= (1 << REFS0);
+
+    // enable ADC, start conversion, set prescalar
+    ADCSRA |= (1 << ADSC) | (1 << ADEN) | (1 << ADPS2) | (1 << ADPS1) | (1 << ADPS0);
+}
+
+static inline void hal_adc_start(uint8_t channel)
+{
+    ADMUX = (ADMUX & 0xF8) | channel;
+    ADCSRA |= (1 << ADSC);
+}
+
+static inline uint8_t hal_adc_busy(void)
+{
+    return (ADCSRA & (1 << ADSC)) != 0;
+}
+
+static inline uint16_t hal_adc_result(void)
+{
+    return ADC;
+}
+
+static inline void hal_adc_scan_start(uint8_t channel, uint16_t step)
+{
+    ADMUX = (ADMUX & 0xF8) | channel;
+    OCR1B = step;
+    TIFR1 = (1 << OCF1B);
+    ADCSRB = (1 << ADTS2) | (1 << ADTS0);           // trigger on timer 1 compare match B
+    ADCSRA |= (1 << ADATE) | (1 << ADIF) | (1 << ADIE);
+}
+
+static inline void hal_adc_scan_next(uint8_t channel, uint16_t step)
+{
+    uint16_t next = OCR1B + step;
+
+    ADMUX = (ADMUX & 0xF8) | channel;
+    if (next > OCR1A)
+    {
+        next -= OCR1A + 1;
+    }
+    OCR1B = next;
+    TIFR1 = (1 << OCF1B);                           // nothing services OC1B, clear it to re-arm the trigger
+}
+
+// sweep timer, TIMER0 in CTC mode. clock_select is the CS0 bits (1 to 5)
+
+static inline void hal_sweep_timer_init(void)
+{
+    TCCR0A = (1 << WGM01);          // set CTC mode
+    TCCR0B = 0;                     // stopped until a sweep starts
+    TCNT0 = 0x00;                   // ensure timer is reset to 0
+    cli();
+    TIMSK0 |= (1 << OCIE0A);        // enable compare match interrupt
+    sei();
+}
+
+static inline void hal_sweep_timer_start(uint8_t clock_select, uint8_t compare)
+{
+    TCCR0B = 0;
+    OCR0A = compare;
+    TCNT0 = 0x00;
+    TIFR0 = (1 << OCF0A);
+    TCCR0B = clock_select;          // start the timer
+}
+
+static inline void hal_sweep_timer_compare(uint8_t compare)
+{
+    OCR0A = compare;                // not buffered in CTC mode, so only change it early in a period
+}
+
+static inline void hal_sweep_timer_stop(void)
+{
+    TCCR0B = 0;
+    TCNT0 = 0x00;
+}
+
+static inline uint8_t hal_sweep_timer_running(void)
+{
+    return (TCCR0B & 0x07) != 0;
+}
+
+// tick timer, TIMER1 in CTC mode at clk/256
+
+static inline void hal_tick_timer_init(uint16_t compare)
+{
+    OCR1A = compare;                                // set overflow value for OC1A
+
+    cli();
+    TCNT1 = 0x00;                                   // ensure counter is reset
+    TIMSK1 = (1 << OCIE1A);                         // enable compare match interrupt
+    TCCR1B = (1 << WGM12) | (1 << CS12);            // set CTC mode and clk/256 prescaler, start the timer
+    sei();
+}
+
+// modulation timer, TIMER2 in CTC mode. clock_select is the CS2 bits (1 to 7)
+
+static inline void hal_mod_timer_start(uint8_t clock_select, uint8_t compare)
+{
+    TCCR2B = 0;
+    TCCR2A = (1 << WGM21);                          // set CTC mode
+    OCR2A = compare;
+    TCNT2 = 0x00;
+    TIFR2 = (1 << OCF2A);
+    TIMSK2 = (1 << OCIE2A);
+    TCCR2B = clock_select;                          // start the timer
+}
+
+static inline void hal_mod_timer_stop(void)
+{
+    TCCR2B = 0;
+    TIMSK2 = 0;
+}
+
+static inline uint16_t hal_tick_timer_count(void)
+{
+    return TCNT1;
+}
+
+static inline uint8_t hal_tick_timer_pending(void)
+{
+    return (TIFR1 & (1 << OCF1A)) != 0;         // compare match not yet serviced
+}
+
+// USART0, 8N1 at double speed
+
+static inline void hal_uart_init(uint16_t ubrr)
+{
+    UBRR0 = ubrr;
+    UCSR0A = (1 << U2X0);
+    UCSR0C = (1 << UCSZ01) | (1 << UCSZ00);
+    UCSR0B = (1 << RXCIE0) | (1 << RXEN0) | (1 << TXEN0);
+}
+
+static inline uint8_t hal_uart_rx_error(void)
+{
+    return (UCSR0A & ((1 << FE0) | (1 << DOR0))) != 0;     // must be read before the data
+}
+
+static inline uint8_t hal_uart_read(void)
+{
+    return UDR0;
+}
+
+static inline void hal_uart_write(uint8_t data)
+{
+    UDR0 = data;
+}
+
+static inline void hal_uart_tx_irq(uint8_t enable)
+{
+    if (enable)
+    {
+        UCSR0B |= (1 << UDRIE0);
+    }
+    else
+    {
+        UCSR0B &= ~(1 << UDRIE0);
+    }
+}
+
+// front panel pins
+
+static inline void hal_encoder_init(void)
+{
+    ROT_ENC_DDR &= ~((1 << ROT_ENC_D0) | (1 << ROT_ENC_D1) | (1 << ROT_END_PB));
+
+    cli();
+    PCMSK2 = (1 << PCINT19) | (1 << PCINT20);   // both encoder channels (PD3, PD4), any change
+    PCICR |= (1 << PCIE2);
+    sei();
+}
+
+static inline uint8_t hal_encoder_pins(void)
+{
+    return ROT_ENC_PIN;
+}
+
+static inline void hal_switch_init(void)
+{
+    SW_DDR &= ~(1 << OUTPUT_ENABLE_SW);
+
+    cli();
+    PCMSK1 = (1 << PCINT9);                     // output enable switch (PC1), any change
+    PCICR |= (1 << PCIE1);
+    sei();
+}
+
+static inline void hal_switch_irq(uint8_t enable)
+{
+    if (enable)
+    {
+        PCIFR = (1 << PCIF1);                   // forget edges seen while it was off
+        PCMSK1 |= (1 << PCINT9);
+    }
+    else
+    {
+        PCMSK1 &= ~(1 << PCINT9);
+    }
+}
+
+static inline uint8_t hal_switch_pins(void)
+{
+    return SW_PIN;
+}
+
+// EEPROM, one byte at a time from the EEPROM ready interrupt
+
+#define HAL_EEPROM_SIZE         (E2END + 1)
+
+static inline uint8_t hal_eeprom_read(uint16_t address)
+{
+    while (EECR & (1 << EEPE));                 // wait for a write to finish
+    EEAR = address;
+    EECR |= (1 << EERE);
+    return EEDR;
+}
+
+static inline void hal_eeprom_write(uint16_t address, uint8_t data)
+{
+    // call with interrupts disabled, EEPE must be set within 4 cycles of
+    // EEMPE. Erase and write takes 3.4 ms, the CPU carries on meanwhile
+    EEAR = address;
+    EEDR = data;
+    EECR |= (1 << EEMPE);
+    EECR |= (1 << EEPE);
+}
+
+static inline void hal_eeprom_irq(uint8_t enable)
+{
+    if (enable)
+    {
+        EECR |= (1 << EERIE);                   // fires while no write is in progress
+    }
+    else
+    {
+        EECR &= ~(1 << EERIE);
+    }
+}
+
+static inline void hal_debug_pin_init(void)
+{
+    DDRD |= (1 << PD5);
+    PORTD &= ~(1 << PD5);
+}
+
+static inline void hal_debug_pin_toggle(void)
+{
+    PORTD ^= (1 << PD5);            // pin 5
+}
+
+#else /* BASE4_NATIVE */
+
+#include <stdint.h>
+
+#ifndef F_CPU
+#define F_CPU                   16000000UL
+#endif
+
+// AVR bit numbers used by globals.h and the drivers
+#define PB0                     0
+#define PB1                     1
+#define PB2                     2
+#define PB3                     3
+#define PB4                     4
+#define PB5                     5
+#define PC0                     0
+#define PC1                     1
+#define PD2                     2
+#define PD3                     3
+#define PD4                     4
+#define PD5                     5
+#define CPHA                    2
+#define CPOL                    3
+
+// avr-libc replacements
+#define ISR(vector, ...)        void vector(void); void vector(void)
+#define PROGMEM
+#define PSTR(s)                 (s)
+#define pgm_read_byte(addr)     (*(const uint8_t *)(addr))
+#define pgm_read_word(addr)     (*(const uint16_t *)(addr))
+#define pgm_read_dword(addr)    (*(const uint32_t *)(addr))
+#define cli()                   hal_sim_irq_set(0)
+#define sei()                   hal_sim_irq_set(1)
+#define _delay_ms(ms)           hal_sim_delay_us((uint32_t)((ms) * 1000UL))
+#define _delay_us(us)           hal_sim_delay_us((uint32_t)(us))
+#define ATOMIC_RESTORESTATE     uint8_t _hal_sreg __attribute__((__cleanup__(hal_sim_irq_restore))) = hal_sim_irq_get()
+#define ATOMIC_FORCEON          uint8_t _hal_sreg __attribute__((__cleanup__(hal_sim_irq_on))) = 1
+#define ATOMIC_BLOCK(type)      for (type, _hal_todo = hal_sim_irq_set(0); _hal_todo; _hal_todo = 0)
+#define HAL_BENCH_BEGIN(name)   ((void)0)
+#define HAL_BENCH_END(name)     ((void)0)
+#define HAL_EEPROM_SIZE         1024
+
+uint8_t hal_sim_irq_get(void);
+uint8_t hal_sim_irq_set(uint8_t enabled);
+void hal_sim_irq_restore(const uint8_t *sreg);
+void hal_sim_irq_on(const uint8_t *sreg);
+void hal_sim_delay_us(uint32_t us);
+
+#include "globals.h"
+
+void hal_init(void);
+void hal_idle(void);
+void hal_sleep(void);
+uint8_t hal_irq_enabled(void);
+void hal_spi_init(void);
+void hal_spi_set_mode(uint8_t mode);
+void hal_spi_write(uint8_t data);
+uint8_t hal_spi_done(void);
+void hal_cs_assert(uint8_t cs);
+void hal_cs_release(uint8_t cs);
+void hal_adc_init(void);
+void hal_adc_start(uint8_t channel);
+uint8_t hal_adc_busy(void);
+uint16_t hal_adc_result(void);
+void hal_adc_scan_start(uint8_t channel, uint16_t step);
+void hal_adc_scan_next(uint8_t channel, uint16_t step);
+void hal_sweep_timer_init(void);
+void hal_sweep_timer_start(uint8_t clock_select, uint8_t compare);
+void hal_sweep_timer_compare(uint8_t compare);
+void hal_sweep_timer_stop(void);
+uint8_t hal_sweep_timer_running(void);
+void hal_tick_timer_init(uint16_t compare);
+void hal_mod_timer_start(uint8_t clock_select, uint8_t compare);
+void hal_mod_timer_stop(void);
+uint16_t hal_tick_timer_count(void);
+uint8_t hal_tick_timer_pending(void);
+void hal_uart_init(uint16_t ubrr);
+uint8_t hal_uart_rx_error(void);
+uint8_t hal_uart_read(void);
+void hal_uart_write(uint8_t data);
+void hal_uart_tx_irq(uint8_t enable);
+void hal_encoder_init(void);
+uint8_t hal_encoder_pins(void);
+void hal_switch_init(void);
+void hal_switch_irq(uint8_t enable);
+uint8_t hal_switch_pins(void);
+uint8_t hal_eeprom_read(uint16_t address);
+void hal_eeprom_write(uint16_t address, uint8_t data);
+void hal_eeprom_irq(uint8_t enable);
+void hal_debug_pin_init(void);
+void hal_debug_pin_toggle(void);
+
+// simulator controls, for harnesses linking against the native build
+uint64_t hal_sim_cycles(void);
+void hal_sim_run_us(uint32_t us);
+void hal_sim_set_adc(uint8_t channel, uint16_t value);
+void hal_sim_set_pin(char port, uint8_t bit, uint8_t level);
+void hal_sim_uart_send(const char *data, uint16_t len);
+uint32_t hal_sim_ad9833_freq_reg(uint8_t reg);
+uint16_t hal_sim_ad9833_phase_reg(uint8_t reg);
+uint16_t hal_sim_ad9833_ctrl(void);
+uint8_t hal_sim_max7221_digit(uint8_t digit);
+
+#endif /* BASE4_NATIVE */
+
+#endif /* HAL_H */
@@ -0,0 +1,1285 @@
+/* 
+ * This file is part of the BASE-4 distribution (website).
+ * Copyright (c) 2018 Tim Buchanan.
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/************************************************************************
+* FILENAME :        hal_sim.c
+*
+* DESCRIPTION :
+*       Simulated HAL for the native (host) build. Time is counted in CPU
+*       cycles and only moves forward in hal_idle() and the delay functions,
+*       jumping straight to the next timer, SPI or ADC event. Interrupt
+*       handlers are called as they would be on the AVR, one at a time and
+*       only while interrupts are enabled.
+*
+*       SPI frames are decoded into AD9833 and MAX7221 models and any change
+*       to the generator output or the display is printed to stdout with a
+*       timestamp, so a run can be compared against a golden output.
+*
+* ENVIRONMENT :
+*       BASE4_SIM_MS          stop after this many simulated ms
+*       BASE4_SIM_ADC<n>      starting value of ADC channel n (default 1023)
+*       BASE4_SIM_SCRIPT      file of timed inputs, one per line:
+*                               <ms> adc <channel> <value>
+*                               <ms> pin <B|C|D> <bit> <0|1>
+*                               <ms> uart <text sent to RXD, up to the end of the line>
+*       BASE4_SIM_TRACE       if set, print every AD9833 and MAX7221 word, and
+*                             every EEPROM byte written
+*       BASE4_SIM_EEPROM      file holding the EEPROM contents. Read at start
+*                             (erased if it doesn't exist) and rewritten on
+*                             every byte write, so settings survive a rerun
+*       BASE4_SIM_PTY         if set, connect the UART to a pseudo terminal (its
+*                             name is printed to stderr) and run in real time
+*
+*       Every line sent on TXD is printed as UART "...".
+*
+************************************************************************/
+
+#ifdef BASE4_NATIVE
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include "hal.h"
+
+#define SIM_CYCLES_PER_US       (F_CPU / 1000000UL)
+#define SIM_SPI_BYTE_CYCLES     16          // 8 bits at fosc/2
+#define SIM_ADC_CYCLES          (13 * 128)  // one conversion at prescaler 128
+#define SIM_IDLE_MAX_CYCLES     (F_CPU / 1000UL)
+#define SIM_PRINT_CYCLES        (F_CPU / 1000UL)
+#define SIM_SCRIPT_MAX          256
+#define SIM_UART_IN_LEN         4096        // bytes waiting to arrive on RXD
+#define SIM_EEPROM_CYCLES       (F_CPU / 1000000UL * 3400)  // 3.4 ms erase and write
+#define SIM_NEVER               0xFFFFFFFFFFFFFFFFULL
+
+// interrupt vectors, any the firmware doesn't define are left out
+void INT0_vect(void) __attribute__((weak));
+void INT1_vect(void) __attribute__((weak));
+void PCINT1_vect(void) __attribute__((weak));
+void PCINT2_vect(void) __attribute__((weak));
+void TIMER2_COMPA_vect(void) __attribute__((weak));
+void TIMER1_COMPA_vect(void) __attribute__((weak));
+void TIMER0_COMPA_vect(void) __attribute__((weak));
+void SPI_STC_vect(void) __attribute__((weak));
+void USART_RX_vect(void) __attribute__((weak));
+void USART_UDRE_vect(void) __attribute__((weak));
+void ADC_vect(void) __attribute__((weak));
+void EE_READY_vect(void) __attribute__((weak));
+
+enum
+{
+    SIM_IRQ_INT0,
+    SIM_IRQ_INT1,
+    SIM_IRQ_PCINT1,
+    SIM_IRQ_PCINT2,
+    SIM_IRQ_TIMER2_COMPA,
+    SIM_IRQ_TIMER1_COMPA,
+    SIM_IRQ_TIMER0_COMPA,
+    SIM_IRQ_SPI_STC,
+    SIM_IRQ_USART_RX,
+    SIM_IRQ_USART_UDRE,
+    SIM_IRQ_ADC,
+    SIM_IRQ_EE_READY,
+    SIM_IRQ_COUNT
+};
+
+typedef struct
+{
+    uint64_t at;
+    char cmd;
+    char port;
+    uint16_t a;
+    uint16_t b;
+    char *text;
+} sim_input_t;
+
+uint64_t _sim_cycles = 0;
+uint64_t _sim_end = SIM_NEVER;
+uint8_t _sim_started = 0;
+uint8_t _sim_irq_enabled = 0;
+uint8_t _sim_in_isr = 0;
+uint8_t _sim_trace = 0;
+uint8_t _sim_pending[SIM_IRQ_COUNT];
+void (*_sim_vectors[SIM_IRQ_COUNT])(void);
+
+sim_input_t _sim_script[SIM_SCRIPT_MAX];
+uint16_t _sim_script_len = 0;
+uint16_t _sim_script_pos = 0;
+
+// SPI bus
+uint8_t _sim_spi_irq = 0;
+uint8_t _sim_spi_mode = 0;
+uint8_t _sim_cs = 0;                        // chip selects currently asserted
+uint64_t _sim_spi_busy_until = 0;
+uint8_t _sim_spi_in_flight = 0;
+uint8_t _sim_spif = 0;
+uint8_t _sim_frame[64];
+uint8_t _sim_frame_len = 0;
+
+// timers
+uint64_t _sim_sweep_period = 0;
+uint64_t _sim_sweep_next = SIM_NEVER;
+uint64_t _sim_sweep_last = 0;               // when the current period began
+uint16_t _sim_sweep_prescale = 0;
+uint64_t _sim_tick_period = 0;
+uint64_t _sim_tick_next = SIM_NEVER;
+uint64_t _sim_mod_period = 0;
+uint64_t _sim_mod_next = SIM_NEVER;
+
+// ADC
+uint16_t _sim_adc_value[8];
+uint8_t _sim_adc_channel = 0;
+uint64_t _sim_adc_done = 0;
+uint16_t _sim_adc_result = 0;
+uint64_t _sim_adc_scan_step = 0;            // cycles between triggered conversions, 0 if not scanning
+uint64_t _sim_adc_scan_next = SIM_NEVER;
+
+// UART
+uint64_t _sim_uart_byte_cycles = 0;         // one 10 bit frame, 0 until the UART is set up
+uint8_t _sim_uart_rx_irq = 0;
+uint8_t _sim_uart_udr_irq = 0;
+uint8_t _sim_uart_in[SIM_UART_IN_LEN];
+uint16_t _sim_uart_in_head = 0;
+uint16_t _sim_uart_in_tail = 0;
+uint64_t _sim_uart_rx_next = SIM_NEVER;
+uint8_t _sim_uart_rxd = 0;
+uint8_t _sim_uart_rxc = 0;                  // a received byte is waiting in UDR0
+uint8_t _sim_uart_dor = 0;
+uint64_t _sim_uart_tx_busy_until = 0;
+uint8_t _sim_uart_tx_in_flight = 0;
+char _sim_uart_line[160];
+uint8_t _sim_uart_line_len = 0;
+int _sim_pty = -1;
+int _sim_pty_slave = -1;                    // kept open so the master doesn't see a hangup
+uint8_t _sim_realtime = 0;
+struct timespec _sim_wall_start;
+
+// EEPROM
+uint8_t _sim_eeprom[HAL_EEPROM_SIZE];
+const char *_sim_eeprom_path = 0;
+uint8_t _sim_eeprom_irq = 0;
+uint8_t _sim_eeprom_in_flight = 0;
+uint64_t _sim_eeprom_busy_until = 0;
+
+// pins
+uint8_t _sim_pin[3] = {0xFF, 0xFF, 0xFF};   // PINB, PINC, PIND
+uint8_t _sim_ext_int = 0;                   // INT0/INT1 falling edge enabled
+uint8_t _sim_pcmsk1 = 0;                    // port C pins raising PCINT1
+uint8_t _sim_pcmsk2 = 0;                    // port D pins raising PCINT2
+
+// device models
+uint16_t _sim_ad9833_ctrl = 0;
+uint32_t _sim_ad9833_freq[2];
+uint16_t _sim_ad9833_phase[2];
+uint16_t _sim_ad9833_lsb[2];
+uint8_t _sim_ad9833_lsb_pending[2];
+uint8_t _sim_max7221_reg[16];
+uint8_t _sim_dirty = 0;
+uint64_t _sim_last_print = 0;
+char _sim_last_line[2][96];
+
+void _sim_dispatch(void);
+void _sim_uart_receive(void);
+
+// interrupt enable
+
+uint8_t hal_sim_irq_get(void)
+{
+    return _sim_irq_enabled;
+}
+
+uint8_t hal_sim_irq_set(uint8_t enabled)
+{
+    /*
+    This function is cli()/sei(). Always returns 1 so it can start an
+    ATOMIC_BLOCK.
+    */
+
+    _sim_irq_enabled = enabled;
+    if (enabled && !_sim_in_isr)
+    {
+        _sim_dispatch();
+    }
+    return 1;
+}
+
+void hal_sim_irq_restore(const uint8_t *sreg)
+{
+    hal_sim_irq_set(*sreg);
+}
+
+void hal_sim_irq_on(const uint8_t *sreg)
+{
+    (void)sreg;
+    hal_sim_irq_set(1);
+}
+
+uint8_t hal_irq_enabled(void)
+{
+    return _sim_irq_enabled;
+}
+
+// device models
+
+void _sim_ad9833_word(uint16_t word)
+{
+    /*
+    This function decodes one 16 bit word sent to the AD9833.
+    */
+
+    uint8_t reg;
+
+    if (_sim_trace)
+    {
+        printf("[%11.3f ms] AD9833 word 0x%04X\n", _sim_cycles / (F_CPU / 1000.0), word);
+    }
+
+    switch (word >> 14)
+    {
+        case 0:                                         // control
+            _sim_ad9833_ctrl = word;
+            _sim_ad9833_lsb_pending[0] = 0;
+            _sim_ad9833_lsb_pending[1] = 0;
+            break;
+
+        case 1:                                         // FREQ0
+        case 2:                                         // FREQ1
+            reg = (word >> 14) - 1;
+            word &= 0x3FFF;
+            if (_sim_ad9833_ctrl & (1 << B28))
+            {
+                // two consecutive writes, LSB then MSB
+                if (!_sim_ad9833_lsb_pending[reg])
+                {
+                    _sim_ad9833_lsb[reg] = word;
+                    _sim_ad9833_lsb_pending[reg] = 1;
+                }
+                else
+                {
+                    _sim_ad9833_freq[reg] = ((uint32_t)word << 14) | _sim_ad9833_lsb[reg];
+                    _sim_ad9833_lsb_pending[reg] = 0;
+                }
+            }
+            else if (_sim_ad9833_ctrl & (1 << HLB))
+            {
+                _sim_ad9833_freq[reg] = (_sim_ad9833_freq[reg] & 0x3FFF) | ((uint32_t)word << 14);
+            }
+            else
+            {
+                _sim_ad9833_freq[reg] = (_sim_ad9833_freq[reg] & 0xFFFC000UL) | word;
+            }
+            break;
+
+        case 3:                                         // PHASE0/PHASE1
+            reg = (word >> 13) & 1;
+            _sim_ad9833_phase[reg] = word & 0x0FFF;
+            break;
+    }
+    _sim_dirty = 1;
+}
+
+void _sim_max7221_word(uint8_t address, uint8_t data)
+{
+    if (_sim_trace)
+    {
+        printf("[%11.3f ms] MAX7221 reg 0x%X = 0x%02X\n", _sim_cycles / (F_CPU / 1000.0), address & 0x0F, data);
+    }
+    _sim_max7221_reg[address & 0x0F] = data;
+    _sim_dirty = 1;
+}
+
+void _sim_end_frame(uint8_t cs)
+{
+    /*
+    This function hands a completed chip select frame to the device it was
+    addressed to.
+    */
+
+    if (cs & (1 << AD9833_CS))
+    {
+        if (!(_sim_spi_mode & (1 << CPOL)))
+        {
+            printf("SIM WARNING: AD9833 frame sent with CPOL = 0\n");
+        }
+        for (uint8_t i = 0; i + 1 < _sim_frame_len; i += 2)
+        {
+            _sim_ad9833_word(((uint16_t)_sim_frame[i] << 8) | _sim_frame[i + 1]);
+        }
+    }
+    if (cs & (1 << MAX7221_CS))
+    {
+        if (_sim_spi_mode & (1 << CPOL))
+        {
+            printf("SIM WARNING: MAX7221 frame sent with CPOL = 1\n");
+        }
+        for (uint8_t i = 0; i + 1 < _sim_frame_len; i += 2)
+        {
+            _sim_max7221_word(_sim_frame[i], _sim_frame[i + 1]);
+        }
+    }
+    _sim_frame_len = 0;
+}
+
+char _sim_segments_to_char(uint8_t segments)
+{
+    static const uint8_t codes[] = {CHAR_0, CHAR_1, CHAR_2, CHAR_3, CHAR_4, CHAR_5, CHAR_6, CHAR_7,
+                                    CHAR_8, CHAR_9, CHAR_A, CHAR_B, CHAR_C, CHAR_D, CHAR_E, CHAR_F,
+                                    CHAR_H, CHAR_I, CHAR_J, CHAR_L, CHAR_P, CHAR_T, CHAR_U, CHAR_Y,
+                                    CHAR_BLANK, CHAR_DASH, CHAR_UNDERSCORE};
+    static const char chars[] = "0123456789ABCDEFHIJLPTUY -_";
+
+    for (uint8_t i = 0; i < sizeof(codes); i++)
+    {
+        if (codes[i] == (segments & 0x7F))
+        {
+            return chars[i];
+        }
+    }
+    return '?';
+}
+
+void _sim_print_state(void)
+{
+    /*
+    This function prints the generator output and the display if either has
+    changed since it was last printed.
+    */
+
+    static const char *waves[] = {"sine", "triangle", "square/2", "square"};
+    char line[96];
+    double ms = _sim_cycles / (F_CPU / 1000.0);
+    uint8_t fsel = (_sim_ad9833_ctrl >> FSELECT) & 1;
+    uint8_t psel = (_sim_ad9833_ctrl >> PSELECT) & 1;
+    uint8_t wave = 0;
+    uint8_t pos = 0;
+
+    if (_sim_ad9833_ctrl & (1 << OPBITEN))
+    {
+        wave = (_sim_ad9833_ctrl & (1 << DIV2)) ? 3 : 2;
+    }
+    else if (_sim_ad9833_ctrl & (1 << MODE))
+    {
+        wave = 1;
+    }
+
+    snprintf(line, sizeof(line), "AD9833 out=%.3f Hz phase=%u wave=%s sleep=%u reset=%u",
+             _sim_ad9833_freq[fsel] * ((double)AD9833_CLOCK / (1UL << 28)), _sim_ad9833_phase[psel],
+             waves[wave], (_sim_ad9833_ctrl >> SLEEP12) & 3, (_sim_ad9833_ctrl >> AD9833_RESET) & 1);
+    if (strcmp(line, _sim_last_line[0]))
+    {
+        printf("[%11.3f ms] %s\n", ms, line);
+        strcpy(_sim_last_line[0], line);
+    }
+
+    pos += snprintf(line, sizeof(line), "DISP \"");
+    for (int8_t digit = D7; digit >= D0; digit--)
+    {
+        uint8_t segments = _sim_max7221_reg[digit];
+
+        line[pos++] = _sim_segments_to_char(segments);
+        if (segments & CHAR_DP)
+        {
+            line[pos++] = '.';
+        }
+    }
+    snprintf(line + pos, sizeof(line) - pos, "\" on=%u test=%u intensity=%u", _sim_max7221_reg[SHUTDOWN] & 1,
+             _sim_max7221_reg[TEST] & 1, _sim_max7221_reg[INTENSITY] & 0x0F);
+    if (strcmp(line, _sim_last_line[1]))
+    {
+        printf("[%11.3f ms] %s\n", ms, line);
+        strcpy(_sim_last_line[1], line);
+    }
+
+    fflush(stdout);
+    _sim_dirty = 0;
+    _sim_last_print = _sim_cycles;
+}
+
+// simulation engine
+
+void _sim_apply_input(sim_input_t *input)
+{
+    if (input->cmd == 'a')
+    {
+        hal_sim_set_adc(input->a, input->b);
+    }
+    else if (input->cmd == 'p')
+    {
+        hal_sim_set_pin(input->port, input->a, input->b);
+    }
+    else if (input->cmd == 'u')
+    {
+        hal_sim_uart_send(input->text, strlen(input->text));
+    }
+}
+
+void _sim_load_script(const char *path)
+{
+    FILE *f = fopen(path, "r");
+    char line[128];
+
+    if (f == 0)
+    {
+        fprintf(stderr, "SIM: can't open script %s\n", path);
+        exit(1);
+    }
+
+    while (fgets(line, sizeof(line), f) && (_sim_script_len < SIM_SCRIPT_MAX))
+    {
+        sim_input_t *input = &_sim_script[_sim_script_len];
+        double ms;
+        char cmd[8];
+        char port;
+        unsigned a = 0;
+        unsigned b = 0;
+        int text = 0;
+
+        if ((line[0] == '#') || (sscanf(line, "%lf %7s %n", &ms, cmd, &text) != 2))
+        {
+            continue;
+        }
+        input->at = (uint64_t)(ms * (F_CPU / 1000UL));
+        if (!strcmp(cmd, "adc") && (sscanf(line, "%*f %*s %u %u", &a, &b) == 2))
+        {
+            input->cmd = 'a';
+        }
+        else if (!strcmp(cmd, "pin") && (sscanf(line, "%*f %*s %c %u %u", &port, &a, &b) == 3))
+        {
+            input->cmd = 'p';
+            input->port = port;
+        }
+        else if (!strcmp(cmd, "uart") && (text > 0))
+        {
+            input->cmd = 'u';
+            input->text = strdup(line + text);  // keeps the newline, it ends the command
+        }
+        else
+        {
+            fprintf(stderr, "SIM: bad script line: %s", line);
+            continue;
+        }
+        input->a = a;
+        input->b = b;
+        _sim_script_len++;
+    }
+    fclose(f);
+}
+
+void _sim_open_pty(void)
+{
+    /*
+    This function makes a raw pseudo terminal for the UART. Time then runs no
+    faster than the wall clock, so a program on the other end sees real baud
+    rate timing.
+    */
+
+    struct termios tio;
+    const char *name;
+
+    _sim_pty = posix_openpt(O_RDWR | O_NOCTTY);
+    if ((_sim_pty < 0) || grantpt(_sim_pty) || unlockpt(_sim_pty) || !(name = ptsname(_sim_pty)))
+    {
+        fprintf(stderr, "SIM: can't open a pty\n");
+        exit(1);
+    }
+
+    _sim_pty_slave = open(name, O_RDWR | O_NOCTTY);
+    if ((_sim_pty_slave >= 0) && (tcgetattr(_sim_pty_slave, &tio) == 0))
+    {
+        cfmakeraw(&tio);
+        tcsetattr(_sim_pty_slave, TCSANOW, &tio);
+    }
+    fcntl(_sim_pty, F_SETFL, O_NONBLOCK);
+    fprintf(stderr, "SIM: UART on %s\n", name);
+
+    _sim_realtime = 1;
+    clock_gettime(CLOCK_MONOTONIC, &_sim_wall_start);
+}
+
+void hal_init(void)
+{
+    /*
+    This function sets up the simulator from the environment.
+    */
+
+    char name[20];
+    const char *value;
+
+    if (_sim_started)
+    {
+        return;
+    }
+    _sim_started = 1;
+
+    _sim_vectors[SIM_IRQ_INT0] = INT0_vect;
+    _sim_vectors[SIM_IRQ_INT1] = INT1_vect;
+    _sim_vectors[SIM_IRQ_PCINT1] = PCINT1_vect;
+    _sim_vectors[SIM_IRQ_PCINT2] = PCINT2_vect;
+    _sim_vectors[SIM_IRQ_TIMER2_COMPA] = TIMER2_COMPA_vect;
+    _sim_vectors[SIM_IRQ_TIMER1_COMPA] = TIMER1_COMPA_vect;
+    _sim_vectors[SIM_IRQ_TIMER0_COMPA] = TIMER0_COMPA_vect;
+    _sim_vectors[SIM_IRQ_SPI_STC] = SPI_STC_vect;
+    _sim_vectors[SIM_IRQ_USART_RX] = USART_RX_vect;
+    _sim_vectors[SIM_IRQ_USART_UDRE] = USART_UDRE_vect;
+    _sim_vectors[SIM_IRQ_ADC] = ADC_vect;
+    _sim_vectors[SIM_IRQ_EE_READY] = EE_READY_vect;
+
+    for (uint8_t ch = 0; ch < 8; ch++)
+    {
+        snprintf(name, sizeof(name), "BASE4_SIM_ADC%u", ch);
+        value = getenv(name);
+        _sim_adc_value[ch] = value ? atoi(value) : 1023;
+    }
+
+    if ((value = getenv("BASE4_SIM_MS")))
+    {
+        _sim_end = (uint64_t)(atof(value) * (F_CPU / 1000UL));
+    }
+    if ((value = getenv("BASE4_SIM_SCRIPT")))
+    {
+        _sim_load_script(value);
+    }
+    _sim_trace = (getenv("BASE4_SIM_TRACE") != 0);
+
+    memset(_sim_eeprom, 0xFF, sizeof(_sim_eeprom));
+    if ((_sim_eeprom_path = getenv("BASE4_SIM_EEPROM")))
+    {
+        FILE *f = fopen(_sim_eeprom_path, "rb");
+
+        if (f)
+        {
+            if (fread(_sim_eeprom, 1, sizeof(_sim_eeprom), f) != sizeof(_sim_eeprom))
+            {
+                fprintf(stderr, "SIM: %s is short, the rest is left erased\n", _sim_eeprom_path);
+            }
+            fclose(f);
+        }
+    }
+
+    if (getenv("BASE4_SIM_PTY"))
+    {
+        _sim_open_pty();
+    }
+}
+
+void _sim_dispatch(void)
+{
+    /*
+    This function runs any pending interrupt handlers, highest priority (lowest
+    vector number) first, the same as the AVR.
+    */
+
+    uint8_t ran = 1;
+
+    while (ran && _sim_irq_enabled && !_sim_in_isr)
+    {
+        ran = 0;
+        for (uint8_t irq = 0; irq < SIM_IRQ_COUNT; irq++)
+        {
+            if (_sim_pending[irq])
+            {
+                _sim_pending[irq] = 0;
+                if (irq == SIM_IRQ_SPI_STC)
+                {
+                    _sim_spif = 0;              // cleared by entering the handler
+                }
+                if (_sim_vectors[irq])
+                {
+                    _sim_in_isr = 1;
+                    _sim_irq_enabled = 0;
+                    _sim_vectors[irq]();
+                    _sim_irq_enabled = 1;
+                    _sim_in_isr = 0;
+                }
+                ran = 1;
+                break;
+            }
+        }
+    }
+}
+
+uint64_t _sim_next_event(void)
+{
+    uint64_t next = SIM_NEVER;
+
+    if (_sim_sweep_next < next) next = _sim_sweep_next;
+    if (_sim_tick_next < next) next = _sim_tick_next;
+    if (_sim_mod_next < next) next = _sim_mod_next;
+    if (_sim_spi_in_flight && (_sim_spi_busy_until < next)) next = _sim_spi_busy_until;
+    if (_sim_adc_scan_next < next) next = _sim_adc_scan_next;
+    if (_sim_uart_rx_next < next) next = _sim_uart_rx_next;
+    if (_sim_uart_tx_in_flight && (_sim_uart_tx_busy_until < next)) next = _sim_uart_tx_busy_until;
+    if (_sim_eeprom_in_flight && (_sim_eeprom_busy_until < next)) next = _sim_eeprom_busy_until;
+    if ((_sim_script_pos < _sim_script_len) && (_sim_script[_sim_script_pos].at < next))
+    {
+        next = _sim_script[_sim_script_pos].at;
+    }
+    return next;
+}
+
+void _sim_advance_to(uint64_t target)
+{
+    /*
+    This function moves simulated time forward to target, raising each event
+    as it is reached and running its handler if interrupts are enabled.
+    */
+
+    while (1)
+    {
+        uint64_t next = _sim_next_event();
+
+        if (next > target)
+        {
+            _sim_cycles = target;
+            break;
+        }
+        if (next > _sim_cycles)
+        {
+            _sim_cycles = next;
+        }
+
+        if (_sim_spi_in_flight && (_sim_spi_busy_until <= _sim_cycles))
+        {
+            _sim_spi_in_flight = 0;
+            _sim_spif = 1;
+            if (_sim_spi_irq)
+            {
+                _sim_pending[SIM_IRQ_SPI_STC] = 1;
+            }
+        }
+        if (_sim_tick_next <= _sim_cycles)
+        {
+            _sim_tick_next += _sim_tick_period;
+            _sim_pending[SIM_IRQ_TIMER1_COMPA] = 1;
+        }
+        if (_sim_mod_next <= _sim_cycles)
+        {
+            _sim_mod_next += _sim_mod_period;
+            _sim_pending[SIM_IRQ_TIMER2_COMPA] = 1;
+        }
+        if (_sim_sweep_next <= _sim_cycles)
+        {
+            _sim_sweep_last = _sim_sweep_next;
+            _sim_sweep_next += _sim_sweep_period;
+            _sim_pending[SIM_IRQ_TIMER0_COMPA] = 1;
+        }
+        if (_sim_adc_scan_next <= _sim_cycles)
+        {
+            _sim_adc_scan_next = SIM_NEVER;         // re-armed by hal_adc_scan_next()
+            _sim_adc_result = _sim_adc_value[_sim_adc_channel];
+            _sim_pending[SIM_IRQ_ADC] = 1;
+        }
+        if (_sim_uart_tx_in_flight && (_sim_uart_tx_busy_until <= _sim_cycles))
+        {
+            _sim_uart_tx_in_flight = 0;
+            if (_sim_uart_udr_irq)
+            {
+                _sim_pending[SIM_IRQ_USART_UDRE] = 1;
+            }
+        }
+        if (_sim_eeprom_in_flight && (_sim_eeprom_busy_until <= _sim_cycles))
+        {
+            _sim_eeprom_in_flight = 0;
+            _sim_pending[SIM_IRQ_EE_READY] = _sim_eeprom_irq;
+        }
+        if (_sim_uart_rx_next <= _sim_cycles)
+        {
+            _sim_uart_receive();
+        }
+        while ((_sim_script_pos < _sim_script_len) && (_sim_script[_sim_script_pos].at <= _sim_cycles))
+        {
+            _sim_apply_input(&_sim_script[_sim_script_pos++]);
+        }
+
+        _sim_dispatch();
+    }
+    _sim_dispatch();
+}
+
+void _sim_uart_receive(void)
+{
+    /*
+    This function lands the next waiting byte in UDR0. As on the AVR a byte
+    arriving before the last one was read is lost and flagged as an overrun.
+    */
+
+    uint8_t data = _sim_uart_in[_sim_uart_in_tail];
+
+    _sim_uart_in_tail = (_sim_uart_in_tail + 1) % SIM_UART_IN_LEN;
+    if (_sim_uart_rxc)
+    {
+        _sim_uart_dor = 1;
+    }
+    else
+    {
+        _sim_uart_rxd = data;
+        _sim_uart_rxc = 1;
+        if (_sim_uart_rx_irq)
+        {
+            _sim_pending[SIM_IRQ_USART_RX] = 1;
+        }
+    }
+
+    if (_sim_uart_in_tail != _sim_uart_in_head)
+    {
+        _sim_uart_rx_next = _sim_cycles + _sim_uart_byte_cycles;
+    }
+    else
+    {
+        _sim_uart_rx_next = SIM_NEVER;
+    }
+}
+
+void _sim_uart_transmit(uint8_t data)
+{
+    /*
+    This function sends a byte from TXD to the pty, and prints each whole line.
+    */
+
+    if (_sim_pty >= 0)
+    {
+        if (write(_sim_pty, &data, 1) != 1)
+        {
+            // nobody has the pty open, the byte is lost as it would be on a wire
+        }
+    }
+
+    if ((data == '\n') || (_sim_uart_line_len == sizeof(_sim_uart_line) - 1))
+    {
+        _sim_uart_line[_sim_uart_line_len] = 0;
+        printf("[%11.3f ms] UART \"%s\"\n", _sim_cycles / (F_CPU / 1000.0), _sim_uart_line);
+        _sim_uart_line_len = 0;
+    }
+    if (data >= ' ')
+    {
+        _sim_uart_line[_sim_uart_line_len++] = data;
+    }
+}
+
+void _sim_realtime_step(void)
+{
+    /*
+    This function takes any bytes written to the pty, then waits for the wall
+    clock to catch up with simulated time.
+    */
+
+    uint8_t buf[64];
+    struct timespec now;
+    int64_t ahead_ns;
+    ssize_t n;
+
+    while ((n = read(_sim_pty, buf, sizeof(buf))) > 0)
+    {
+        hal_sim_uart_send((const char *)buf, n);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    ahead_ns = (int64_t)(_sim_cycles * (1000000000.0 / F_CPU))
+             - ((int64_t)(now.tv_sec - _sim_wall_start.tv_sec) * 1000000000LL + (now.tv_nsec - _sim_wall_start.tv_nsec));
+    if (ahead_ns > 0)
+    {
+        struct timespec wait = {ahead_ns / 1000000000LL, ahead_ns % 1000000000LL};
+
+        nanosleep(&wait, 0);
+    }
+}
+
+void _sim_after_step(void)
+{
+    if (_sim_dirty && (_sim_cycles - _sim_last_print >= SIM_PRINT_CYCLES) && (_sim_cs == 0))
+    {
+        _sim_print_state();
+    }
+    if (_sim_cycles >= _sim_end)
+    {
+        _sim_print_state();
+        exit(0);
+    }
+    if (_sim_realtime)
+    {
+        _sim_realtime_step();
+    }
+}
+
+void hal_idle(void)
+{
+    /*
+    This function is called from busy loops. Nothing else can change until the
+    next event, so time jumps straight to it.
+    */
+
+    uint64_t target = _sim_next_event();
+
+    if (target > _sim_cycles + SIM_IDLE_MAX_CYCLES)
+    {
+        target = _sim_cycles + SIM_IDLE_MAX_CYCLES;
+    }
+    if (target > _sim_end)
+    {
+        target = _sim_end;
+    }
+    _sim_advance_to(target);
+    _sim_after_step();
+}
+
+void hal_sleep(void)
+{
+    /*
+    This function enables interrupts and sleeps until the next one.
+    */
+
+    sei();
+    hal_idle();
+}
+
+void hal_sim_delay_us(uint32_t us)
+{
+    uint64_t target = _sim_cycles + (uint64_t)us * SIM_CYCLES_PER_US;
+
+    while (_sim_cycles < target)
+    {
+        uint64_t step = target;
+
+        if (step > _sim_cycles + SIM_IDLE_MAX_CYCLES)
+        {
+            step = _sim_cycles + SIM_IDLE_MAX_CYCLES;
+        }
+        if (step > _sim_end)
+        {
+            step = _sim_end;
+        }
+        _sim_advance_to(step);
+        _sim_after_step();
+    }
+}
+
+// SPI
+
+void hal_spi_init(void)
+{
+    _sim_spi_irq = 1;
+    _sim_spi_mode = (1 << CPOL);
+}
+
+void hal_spi_set_mode(uint8_t mode)
+{
+    _sim_spi_mode = mode;
+}
+
+void hal_spi_write(uint8_t data)
+{
+    if (_sim_frame_len < sizeof(_sim_frame))
+    {
+        _sim_frame[_sim_frame_len++] = data;
+    }
+    _sim_spif = 0;                          // SPSR then SPDR clears SPIF, and so the interrupt
+    _sim_pending[SIM_IRQ_SPI_STC] = 0;
+    _sim_spi_in_flight = 1;
+    _sim_spi_busy_until = _sim_cycles + SIM_SPI_BYTE_CYCLES;
+}
+
+uint8_t hal_spi_done(void)
+{
+    if (_sim_spi_in_flight && (_sim_spi_busy_until <= _sim_cycles))
+    {
+        _sim_spi_in_flight = 0;
+        _sim_spif = 1;
+    }
+    return _sim_spif;
+}
+
+void hal_cs_assert(uint8_t cs)
+{
+    _sim_cs |= cs;
+    _sim_frame_len = 0;
+}
+
+void hal_cs_release(uint8_t cs)
+{
+    _sim_end_frame(cs & _sim_cs);
+    _sim_cs &= ~cs;
+}
+
+// ADC
+
+void hal_adc_init(void)
+{
+}
+
+void hal_adc_start(uint8_t channel)
+{
+    _sim_adc_channel = channel & 0x07;
+    _sim_adc_done = _sim_cycles + SIM_ADC_CYCLES;
+    _sim_adc_result = _sim_adc_value[_sim_adc_channel];
+}
+
+uint8_t hal_adc_busy(void)
+{
+    if (_sim_cycles < _sim_adc_done)
+    {
+        // nothing else happens while the main loop spins, skip to the result
+        _sim_advance_to(_sim_adc_done);
+    }
+    return 0;
+}
+
+uint16_t hal_adc_result(void)
+{
+    return _sim_adc_result;
+}
+
+void _sim_adc_scan_arm(void)
+{
+    // conversions are triggered by timer 1, so nothing happens until it runs
+    if (_sim_adc_scan_step && _sim_tick_period)
+    {
+        _sim_adc_scan_next = _sim_cycles + _sim_adc_scan_step + SIM_ADC_CYCLES;
+    }
+}
+
+void hal_adc_scan_start(uint8_t channel, uint16_t step)
+{
+    _sim_adc_channel = channel & 0x07;
+    _sim_adc_scan_step = 256ULL * step;
+    _sim_adc_scan_arm();
+}
+
+void hal_adc_scan_next(uint8_t channel, uint16_t step)
+{
+    _sim_adc_channel = channel & 0x07;
+    _sim_adc_scan_step = 256ULL * step;
+    _sim_adc_scan_arm();
+}
+
+// timers
+
+void hal_sweep_timer_init(void)
+{
+    _sim_sweep_next = SIM_NEVER;
+    sei();
+}
+
+void hal_sweep_timer_start(uint8_t clock_select, uint8_t compare)
+{
+    static const uint16_t prescale[8] = {0, 1, 8, 64, 256, 1024, 0, 0};
+
+    _sim_sweep_prescale = prescale[clock_select & 7];
+    _sim_sweep_period = (uint64_t)_sim_sweep_prescale * (compare + 1);
+    _sim_sweep_last = _sim_cycles;
+    _sim_sweep_next = _sim_sweep_period ? (_sim_cycles + _sim_sweep_period) : SIM_NEVER;
+    _sim_pending[SIM_IRQ_TIMER0_COMPA] = 0;
+}
+
+void hal_sweep_timer_compare(uint8_t compare)
+{
+    // takes effect in the period already running, as in CTC mode
+    _sim_sweep_period = (uint64_t)_sim_sweep_prescale * (compare + 1);
+    if (_sim_sweep_next != SIM_NEVER)
+    {
+        _sim_sweep_next = _sim_sweep_last + _sim_sweep_period;
+    }
+}
+
+void hal_sweep_timer_stop(void)
+{
+    _sim_sweep_next = SIM_NEVER;
+    _sim_pending[SIM_IRQ_TIMER0_COMPA] = 0;
+}
+
+uint8_t hal_sweep_timer_running(void)
+{
+    return (_sim_sweep_next != SIM_NEVER);
+}
+
+void hal_tick_timer_init(uint16_t compare)
+{
+    _sim_tick_period = 256ULL * (compare + 1);
+    _sim_tick_next = _sim_cycles + _sim_tick_period;
+    _sim_adc_scan_arm();
+    sei();
+}
+
+void hal_mod_timer_start(uint8_t clock_select, uint8_t compare)
+{
+    static const uint16_t prescale[8] = {0, 1, 8, 32, 64, 128, 256, 1024};
+
+    _sim_mod_period = (uint64_t)prescale[clock_select & 7] * (compare + 1);
+    _sim_mod_next = _sim_mod_period ? (_sim_cycles + _sim_mod_period) : SIM_NEVER;
+    _sim_pending[SIM_IRQ_TIMER2_COMPA] = 0;
+}
+
+void hal_mod_timer_stop(void)
+{
+    _sim_mod_next = SIM_NEVER;
+    _sim_pending[SIM_IRQ_TIMER2_COMPA] = 0;
+}
+
+uint16_t hal_tick_timer_count(void)
+{
+    if (_sim_tick_period == 0)
+    {
+        return 0;
+    }
+    return (_sim_cycles - (_sim_tick_next - _sim_tick_period)) / 256;
+}
+
+uint8_t hal_tick_timer_pending(void)
+{
+    return _sim_pending[SIM_IRQ_TIMER1_COMPA];
+}
+
+// UART
+
+void hal_uart_init(uint16_t ubrr)
+{
+    _sim_uart_byte_cycles = 10ULL * 8 * (ubrr + 1);    // start, 8 data, stop at double speed
+    _sim_uart_rx_irq = 1;
+    if ((_sim_uart_in_tail != _sim_uart_in_head) && (_sim_uart_rx_next == SIM_NEVER))
+    {
+        _sim_uart_rx_next = _sim_cycles + _sim_uart_byte_cycles;
+    }
+}
+
+uint8_t hal_uart_rx_error(void)
+{
+    return _sim_uart_dor;
+}
+
+uint8_t hal_uart_read(void)
+{
+    _sim_uart_rxc = 0;
+    _sim_uart_dor = 0;
+    return _sim_uart_rxd;
+}
+
+void hal_uart_write(uint8_t data)
+{
+    if (_sim_uart_tx_in_flight)
+    {
+        printf("SIM WARNING: UART written while busy\n");
+    }
+    _sim_uart_transmit(data);
+    _sim_uart_tx_in_flight = 1;
+    _sim_uart_tx_busy_until = _sim_cycles + _sim_uart_byte_cycles;
+}
+
+void hal_uart_tx_irq(uint8_t enable)
+{
+    _sim_uart_udr_irq = enable;
+    _sim_pending[SIM_IRQ_USART_UDRE] = (enable && !_sim_uart_tx_in_flight);
+}
+
+// front panel pins
+
+void hal_encoder_init(void)
+{
+    _sim_ext_int = 0;
+    _sim_pcmsk2 = (1 << PD3) | (1 << PD4);
+    sei();
+}
+
+uint8_t hal_encoder_pins(void)
+{
+    return _sim_pin[2];
+}
+
+void hal_switch_init(void)
+{
+    _sim_pcmsk1 = (1 << PC1);
+    sei();
+}
+
+void hal_switch_irq(uint8_t enable)
+{
+    if (enable)
+    {
+        _sim_pending[SIM_IRQ_PCINT1] = 0;
+        _sim_pcmsk1 |= (1 << PC1);
+    }
+    else
+    {
+        _sim_pcmsk1 &= ~(1 << PC1);
+    }
+}
+
+uint8_t hal_switch_pins(void)
+{
+    return _sim_pin[1];
+}
+
+// EEPROM
+
+uint8_t hal_eeprom_read(uint16_t address)
+{
+    return _sim_eeprom[address % HAL_EEPROM_SIZE];
+}
+
+void hal_eeprom_write(uint16_t address, uint8_t data)
+{
+    /*
+    This function writes one byte, which takes 3.4 ms. The whole EEPROM is
+    saved to BASE4_SIM_EEPROM straight away, as if power could go at any time.
+    */
+
+    FILE *f;
+
+    address %= HAL_EEPROM_SIZE;
+    _sim_eeprom[address] = data;
+    _sim_eeprom_in_flight = 1;
+    _sim_eeprom_busy_until = _sim_cycles + SIM_EEPROM_CYCLES;
+    _sim_pending[SIM_IRQ_EE_READY] = 0;
+
+    if (_sim_trace)
+    {
+        printf("[%11.3f ms] EEPROM 0x%03X = 0x%02X\n", _sim_cycles / (F_CPU / 1000.0), address, data);
+    }
+    if (_sim_eeprom_path && (f = fopen(_sim_eeprom_path, "wb")))
+    {
+        fwrite(_sim_eeprom, 1, sizeof(_sim_eeprom), f);
+        fclose(f);
+    }
+}
+
+void hal_eeprom_irq(uint8_t enable)
+{
+    // level triggered, pending whenever enabled and no write is in progress
+    _sim_eeprom_irq = enable;
+    _sim_pending[SIM_IRQ_EE_READY] = enable && !_sim_eeprom_in_flight;
+}
+
+void hal_debug_pin_init(void)
+{
+}
+
+void hal_debug_pin_toggle(void)
+{
+}
+
+// simulator controls
+
+uint64_t hal_sim_cycles(void)
+{
+    return _sim_cycles;
+}
+
+void hal_sim_run_us(uint32_t us)
+{
+    hal_sim_delay_us(us);
+}
+
+void hal_sim_set_adc(uint8_t channel, uint16_t value)
+{
+    _sim_adc_value[channel & 0x07] = value;
+}
+
+void hal_sim_set_pin(char port, uint8_t bit, uint8_t level)
+{
+    /*
+    This function drives an input pin, raising INT0/INT1 on a falling edge
+    and PCINT1/PCINT2 on any change, if they are enabled.
+    */
+
+    uint8_t index = port - 'B';
+    uint8_t old;
+
+    if (index > 2)
+    {
+        return;
+    }
+
+    old = _sim_pin[index];
+    if (level)
+    {
+        _sim_pin[index] |= (1 << bit);
+    }
+    else
+    {
+        _sim_pin[index] &= ~(1 << bit);
+    }
+
+    if ((index == 1) && ((old ^ _sim_pin[index]) & _sim_pcmsk1))
+    {
+        _sim_pending[SIM_IRQ_PCINT1] = 1;
+    }
+    if (index == 2)
+    {
+        uint8_t fell = old & ~_sim_pin[index];
+
+        if ((fell & (1 << PD2)) && (_sim_ext_int & (1 << 0)))
+        {
+            _sim_pending[SIM_IRQ_INT0] = 1;
+        }
+        if ((fell & (1 << PD3)) && (_sim_ext_int & (1 << 1)))
+        {
+            _sim_pending[SIM_IRQ_INT1] = 1;
+        }
+        if ((old ^ _sim_pin[index]) & _sim_pcmsk2)
+        {
+            _sim_pending[SIM_IRQ_PCINT2] = 1;
+        }
+    }
+}
+
+void hal_sim_uart_send(const char *data, uint16_t len)
+{
+    /*
+    This function queues bytes to arrive on RXD, back to back at the baud rate.
+    */
+
+    for (uint16_t i = 0; i < len; i++)
+    {
+        uint16_t next = (_sim_uart_in_head + 1) % SIM_UART_IN_LEN;
+
+        if (next == _sim_uart_in_tail)
+        {
+            break;
+        }
+        _sim_uart_in[_sim_uart_in_head] = data[i];
+        _sim_uart_in_head = next;
+    }
+
+    if (_sim_uart_byte_cycles && (_sim_uart_rx_next == SIM_NEVER) && (_sim_uart_in_tail != _sim_uart_in_head))
+    {
+        _sim_uart_rx_next = _sim_cycles + _sim_uart_byte_cycles;
+    }
+}
+
+uint32_t hal_sim_ad9833_freq_reg(uint8_t reg)
+{
+    return _sim_ad9833_freq[reg & 1];
+}
+
+uint16_t hal_sim_ad9833_phase_reg(uint8_t reg)
+{
+    return _sim_ad9833_phase[reg & 1];
+}
+
+uint16_t hal_sim_ad9833_ctrl(void)
+{
+    return _sim_ad9833_ctrl;
+}
+
+uint8_t hal_sim_max7221_digit(uint8_t digit)
+{
+    return _sim_max7221_reg[digit & 0x0F];
+}
+
+#endif /* BASE4_NATIVE */
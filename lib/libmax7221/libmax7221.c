@@ -15,13 +15,46 @@
  * along with this program. If not, see <http://www.gnu.org/licenses/>.
 */
 
-#include <avr/io.h>
-#include <math.h>
-#include <string.h>
-#include <stdlib.h>
+#include "hal.h"
 #include "libmax7221.h"
+#include "libspi.h"
 #include "globals.h"
 
+uint8_t _max7221_fb[8];                     // segment data we want on each digit
+uint8_t _max7221_shown[8];                  // segment data last sent to each digit
+uint8_t _max7221_touched = 0;               // bit per digit written since last commit
+uint8_t _max7221_stale = 0xFF;              // bit per digit whose contents are unknown
+uint8_t _max7221_reg_cache[16];             // last value sent to each control register
+uint16_t _max7221_reg_valid = 0;            // bit per control register holding a cached value
+uint32_t max7221_frames_sent = 0;
+uint32_t max7221_frames_suppressed = 0;
+
+// segment data for ASCII MAX7221_GLYPH_FIRST to MAX7221_GLYPH_LAST
+const uint8_t _max7221_glyphs[] PROGMEM =
+{
+    CHAR_BLANK, CHAR_BLANK, CHAR_BLANK, CHAR_BLANK,     // space ! " #
+    CHAR_BLANK, CHAR_BLANK, CHAR_BLANK, CHAR_BLANK,     // $ % & '
+    CHAR_BLANK, CHAR_BLANK, CHAR_BLANK, CHAR_BLANK,     // ( ) * +
+    CHAR_BLANK, CHAR_DASH,  CHAR_DP,    CHAR_BLANK,     // , - . /
+    CHAR_0,     CHAR_1,     CHAR_2,     CHAR_3,         // 0 1 2 3
+    CHAR_4,     CHAR_5,     CHAR_6,     CHAR_7,         // 4 5 6 7
+    CHAR_8,     CHAR_9,     CHAR_BLANK, CHAR_BLANK,     // 8 9 : ;
+    CHAR_BLANK, CHAR_BLANK, CHAR_BLANK, CHAR_BLANK,     // < = > ?
+    CHAR_BLANK, CHAR_A,     CHAR_B,     CHAR_C,         // @ A B C
+    CHAR_D,     CHAR_E,     CHAR_F,     CHAR_BLANK,     // D E F G
+    CHAR_H,     CHAR_I,     CHAR_J,     CHAR_BLANK,     // H I J K
+    CHAR_L,     CHAR_BLANK, CHAR_BLANK, CHAR_BLANK,     // L M N O
+    CHAR_P,     CHAR_BLANK, CHAR_BLANK, CHAR_S,         // P Q R S
+    CHAR_T,     CHAR_U,     CHAR_BLANK, CHAR_BLANK,     // T U V W
+    CHAR_BLANK, CHAR_Y,     CHAR_BLANK, CHAR_BLANK,     // X Y Z [
+    CHAR_BLANK, CHAR_BLANK, CHAR_BLANK, CHAR_UNDERSCORE // \ ] ^ _
+};
+
+const uint32_t _max7221_pow10[8] PROGMEM =
+{
+    1UL, 10UL, 100UL, 1000UL, 10000UL, 100000UL, 1000000UL, 10000000UL
+};
+
 void max7221_init(void)
 {
     /*
@@ -29,10 +62,10 @@ void max7221_init(void)
     */
 
     // set scan limit to all 8 digits
-    max7221_write(SCAN_LIMIT, 0x07);
+    max7221_write_reg(SCAN_LIMIT, 0x07);
 
     // set no decode mode on all bits
-    max7221_write(DECODE_MODE, 0x00);
+    max7221_write_reg(DECODE_MODE, 0x00);
 
     // set intensity to FULL POWER
     max7221_set_intensity(15);
@@ -42,132 +75,119 @@ void max7221_init(void)
 
     // ensure display is blank
     max7221_blank_display();
-
+    max7221_commit();
 }
 
 void max7221_write(uint8_t address, uint8_t data)
 {
-    SPCR &= ~(1 << CPOL);           // set clock polarity
-    SPI_PORT &= ~(1 << MAX7221_CS); // assert MAX7221 chip select
-    //_delay_us(5);
-    SPDR = (address & 0x0F);        // only send lower nibble of address
-    while(!(SPSR & (1<<SPIF)));     // wait for send completion
-    SPDR = data;
-    while(!(SPSR & (1<<SPIF)));
-    SPI_PORT |= (1 << MAX7221_CS);
-    SPCR |= (1 << CPOL);            // reset clock polarity
+    uint8_t frame[2];
+
+    frame[0] = (address & 0x0F);        // only send lower nibble of address
+    frame[1] = data;
+
+    spi_enqueue(SPI_PRIO_LOW, (1 << MAX7221_CS), SPI_MODE_0, frame, 2);
+    max7221_frames_sent += 1;
+}
+
+void max7221_write_reg(uint8_t address, uint8_t data)
+{
+    /*
+    This function writes a control register, skipping the write if the register
+    already holds this value.
+    */
+
+    address &= 0x0F;
+
+    if ((_max7221_reg_valid & (1U << address)) && (_max7221_reg_cache[address] == data))
+    {
+        max7221_frames_suppressed += 1;
+        return;
+    }
+
+    max7221_write(address, data);
+    _max7221_reg_cache[address] = data;
+    _max7221_reg_valid |= (1U << address);
+}
+
+void max7221_set_digit(uint8_t digit, uint8_t segments)
+{
+    /*
+    This function puts raw segment data for a digit (D0 to D7) into the
+    framebuffer. Nothing is sent until max7221_commit() is called.
+    */
+
+    if ((digit < D0) || (digit > D7)) return;
+
+    _max7221_fb[digit - D0] = segments;
+    _max7221_touched |= (1 << (digit - D0));
+}
+
+void max7221_commit(void)
+{
+    /*
+    This function sends every digit that has changed since the last commit.
+    Digits that were rewritten with the same contents are not sent.
+    */
 
+    for (uint8_t i = 0; i < 8; i++)
+    {
+        uint8_t bit = (1 << i);
 
+        if ((_max7221_stale & bit) || (_max7221_fb[i] != _max7221_shown[i]))
+        {
+            max7221_write(D0 + i, _max7221_fb[i]);
+            _max7221_shown[i] = _max7221_fb[i];
+        }
+        else if (_max7221_touched & bit)
+        {
+            max7221_frames_suppressed += 1;
+        }
+    }
+    _max7221_touched = 0;
+    _max7221_stale = 0;
 }
 
 void display_test(uint8_t mode)
 {
     if (mode)
     {
-        max7221_write(TEST, 0x01);
+        max7221_write_reg(TEST, 0x01);
     }
     else
     {
-        max7221_write(TEST, 0x00);
+        max7221_write_reg(TEST, 0x00);
     }
 }
 
 void max7221_set_intensity(uint8_t intensity_value)
 {
     if (intensity_value > 15) intensity_value = 15;
-    max7221_write(INTENSITY, intensity_value);
+    max7221_write_reg(INTENSITY, intensity_value);
 }
 
-uint8_t max7221_putc(uint8_t digit, uint8_t data)
+uint8_t max7221_glyph(uint8_t data)
 {
-    //if ((digit < 1) || (digit > 8)) return -1;
-    uint8_t out_char;
-    switch (data)
+    /*
+    This function returns the segment data for an ASCII character. Lower case
+    is shown as upper case, characters with no glyph are shown blank.
+    */
+
+    if ((data >= 'a') && (data <= 'z'))
     {
-        case '0':
-            out_char = CHAR_0;
-            break;
-        case '1':
-            out_char = CHAR_1;
-            break;
-        case '2':
-            out_char = CHAR_2;
-            break;
-        case '3':
-            out_char = CHAR_3;
-            break;
-        case '4':
-            out_char = CHAR_4;
-            break;
-        case '5':
-            out_char = CHAR_5;
-            break;
-        case '6':
-            out_char = CHAR_6;
-            break;
-        case '7':
-            out_char = CHAR_7;
-            break;
-        case '8':
-            out_char = CHAR_8;
-            break;
-        case '9':
-            out_char = CHAR_9;
-            break;
-        case ' ':
-            out_char = CHAR_BLANK;
-            break;
-        case 'A':
-            out_char = CHAR_A;
-            break;
-        case 'B':
-            out_char = CHAR_B;
-            break;
-        case 'C':
-            out_char = CHAR_C;
-            break;
-        case 'D':
-            out_char = CHAR_D;
-            break;
-        case 'E':
-            out_char = CHAR_E;
-            break;
-        case 'F':
-            out_char = CHAR_F;
-            break;
-        case 'H':
-            out_char = CHAR_H;
-            break;
-        case 'I':
-            out_char = CHAR_I;
-            break;
-        case 'J':
-            out_char = CHAR_J;
-            break;
-        case 'L':
-            out_char = CHAR_L;
-            break;
-        case 'P':
-            out_char = CHAR_P;
-            break;
-        case 'S':
-            out_char = CHAR_S;
-            break;
-        case 'T':
-            out_char = CHAR_T;
-            break;
-        case 'U':
-            out_char = CHAR_U;
-            break;
-        case 'Y':
-            out_char = CHAR_Y;
-            break;
-        case '-':
-            out_char = CHAR_DASH;
-            break;
+        data -= ('a' - 'A');
     }
-    
-    max7221_write(digit, out_char);
+
+    if ((data < MAX7221_GLYPH_FIRST) || (data > MAX7221_GLYPH_LAST))
+    {
+        return CHAR_BLANK;
+    }
+
+    return pgm_read_byte(&_max7221_glyphs[data - MAX7221_GLYPH_FIRST]);
+}
+
+uint8_t max7221_putc(uint8_t digit, uint8_t data)
+{
+    max7221_set_digit(digit, max7221_glyph(data));
     return 0;
 }
 
@@ -185,41 +205,87 @@ uint8_t max7221_puts(uint8_t data[])
 
 void max7221_powerup(void)
 {
-    max7221_write(SHUTDOWN, 0x01);
+    max7221_write_reg(SHUTDOWN, 0x01);
 }
 
 void max7221_powerdown(void)
 {
-    max7221_write(SHUTDOWN, 0x00);
+    max7221_write_reg(SHUTDOWN, 0x00);
 }
 
 void max7221_blank_display(void)
 {
     
-    // blanks the entire display.
+    // blanks the entire display (in the framebuffer).
 
-    for (uint8_t i = 1; i < 9; i++)
+    for (uint8_t i = D0; i <= D7; i++)
     {
-        max7221_write(i, CHAR_BLANK);
+        max7221_set_digit(i, CHAR_BLANK);
     }
 }
 
-void max7221_display_int(uint32_t value)
+void max7221_display_uint(uint32_t value, uint8_t dp_digit, uint8_t zero_pad)
 {
-    uint8_t int_length = floor(log10(abs(value))) + 1;              // determine number of digits
-    char str[int_length];                                       
-    //uint8_t blank_spaces = (8 - int_length);                          // calculate how many blank digits we need to pad with
-    //char blank_str[] = {blank_spaces * ' '};
+    /*
+    This function renders an unsigned integer right aligned across the display.
+    Digits are found by repeated subtraction of powers of ten, so the cost is
+    bounded and no division or string functions are used. Leading zeros are
+    blanked unless zero_pad is set. If dp_digit is a digit address (D0 to D7)
+    its decimal point is lit, and zeros from there rightwards are always shown.
+    Values that do not fit are shown as dashes.
+    */
 
-    
-    ltoa(value, str, 10);
-    strrev(str);
-    //strcat(str, blank_str);
-    max7221_blank_display();
-    for (uint8_t i = 0; i < strlen(str); i++)
+    uint8_t leading = !zero_pad;
+
+    if (value > 99999999UL)
     {
-        max7221_putc((i + 1), str[i]);
+        for (uint8_t i = D0; i <= D7; i++)
+        {
+            max7221_set_digit(i, CHAR_DASH);
+        }
+        return;
     }
+
+    for (int8_t k = 7; k >= 0; k--)
+    {
+        uint32_t power = pgm_read_dword(&_max7221_pow10[k]);
+        uint8_t n = 0;
+        uint8_t segments;
+
+        while (value >= power)
+        {
+            value -= power;
+            n++;
+        }
+
+        if ((n != 0) || (k == 0) || ((D0 + k) <= dp_digit))
+        {
+            leading = 0;
+        }
+
+        if (leading)
+        {
+            segments = CHAR_BLANK;
+        }
+        else
+        {
+            segments = pgm_read_byte(&_max7221_glyphs['0' - MAX7221_GLYPH_FIRST + n]);
+        }
+
+        if ((D0 + k) == dp_digit)
+        {
+            segments |= CHAR_DP;
+        }
+
+        max7221_set_digit(D0 + k, segments);
+    }
+}
+
+void max7221_display_int(uint32_t value)
+{
+    HAL_BENCH_BEGIN(max7221_display_int);
+    max7221_display_uint(value, 0, 0);
+    HAL_BENCH_END(max7221_display_int);
 }
 
 void max7221_splash(void)
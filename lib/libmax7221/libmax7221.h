@@ -15,16 +15,32 @@
  * along with this program. If not, see <http://www.gnu.org/licenses/>.
 */
 
+// display framebuffer. Digit writes go to an 8 byte shadow framebuffer and
+// max7221_commit() sends only the digits that changed. Control register writes
+// are cached and skipped if the value is unchanged.
+
+// ASCII range covered by the glyph table
+#define MAX7221_GLYPH_FIRST     ' '
+#define MAX7221_GLYPH_LAST      '_'
+
+extern uint32_t max7221_frames_sent;
+extern uint32_t max7221_frames_suppressed;
+
 // prototypes
 
 void max7221_init(void);
 void max7221_write(uint8_t address, uint8_t data);
+void max7221_write_reg(uint8_t address, uint8_t data);
+void max7221_set_digit(uint8_t digit, uint8_t segments);
+void max7221_commit(void);
 void display_test(uint8_t mode);
 void max7221_set_intensity(uint8_t intensity_value);
+uint8_t max7221_glyph(uint8_t data);
 uint8_t max7221_putc(uint8_t digit, uint8_t data);
 uint8_t max7221_puts(uint8_t data[]);
 void max7221_powerup(void);
 void max7221_powerdown(void);
 void max7221_blank_display(void);
 void max7221_splash(void);
+void max7221_display_uint(uint32_t value, uint8_t dp_digit, uint8_t zero_pad);
 void max7221_display_int(uint32_t value);
\ No newline at end of file
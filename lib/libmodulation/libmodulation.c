@@ -0,0 +1,672 @@
+/* 
+ * This file is part of the BASE-4 distribution (website).
+ * Copyright (c) 2018 Tim Buchanan.
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "hal.h"
+#include "libmodulation.h"
+#include "libad9833.h"
+#include "libevent.h"
+#include "libspi.h"
+#include "libuart.h"
+#include "globals.h"
+
+// frame receiver states
+#define MOD_RX_SYNC             0
+#define MOD_RX_COUNT            1
+#define MOD_RX_DATA             2
+#define MOD_RX_CHECK            3
+
+// modulating waveforms, in MOD_SHAPE_ order, one cycle from -127 to 127
+const int8_t _mod_waves[3][MOD_WAVE_LEN] PROGMEM =
+{
+    {
+           0,   12,   25,   37,   49,   60,   71,   81,   90,   98,  106,  112,  117,  122,  125,  126,
+         127,  126,  125,  122,  117,  112,  106,   98,   90,   81,   71,   60,   49,   37,   25,   12,
+           0,  -12,  -25,  -37,  -49,  -60,  -71,  -81,  -90,  -98, -106, -112, -117, -122, -125, -126,
+        -127, -126, -125, -122, -117, -112, -106,  -98,  -90,  -81,  -71,  -60,  -49,  -37,  -25,  -12
+    },
+    {
+           0,    8,   16,   24,   32,   40,   48,   56,   64,   71,   79,   87,   95,  103,  111,  119,
+         127,  119,  111,  103,   95,   87,   79,   71,   64,   56,   48,   40,   32,   24,   16,    8,
+           0,   -8,  -16,  -24,  -32,  -40,  -48,  -56,  -64,  -71,  -79,  -87,  -95, -103, -111, -119,
+        -127, -119, -111, -103,  -95,  -87,  -79,  -71,  -64,  -56,  -48,  -40,  -32,  -24,  -16,   -8
+    },
+    {
+         127,  127,  127,  127,  127,  127,  127,  127,  127,  127,  127,  127,  127,  127,  127,  127,
+         127,  127,  127,  127,  127,  127,  127,  127,  127,  127,  127,  127,  127,  127,  127,  127,
+        -127, -127, -127, -127, -127, -127, -127, -127, -127, -127, -127, -127, -127, -127, -127, -127,
+        -127, -127, -127, -127, -127, -127, -127, -127, -127, -127, -127, -127, -127, -127, -127, -127
+    }
+};
+
+// TIMER2 prescalers, clock select is the index + 1
+const uint16_t _mod_prescale[7] PROGMEM = {1, 8, 32, 64, 128, 256, 1024};
+
+uint8_t _mod_clock_select = 0;              // timer setting for the chosen rate
+uint8_t _mod_compare = 0;
+uint32_t _mod_rate = 0;                     // rate the timer really runs at
+
+volatile uint8_t _mod_state = MOD_OFF;
+uint32_t _mod_ring[MOD_RING_LEN];
+volatile uint8_t _mod_head = 0;             // written by the UART receive interrupt only
+volatile uint8_t _mod_tail = 0;             // written by the timer interrupt only
+uint8_t _mod_playing = 0;                   // false while the ring is filling
+uint8_t _mod_xoff = 0;                      // true if the host has been sent XOFF
+uint8_t _mod_freq_reg = 0;                  // registers driving the output
+uint8_t _mod_phase_reg = 0;
+uint32_t _mod_last = 0;                     // last word sent
+uint32_t _mod_acc = 0;                      // wavetable position
+uint32_t _mod_inc = 0;                      // added to _mod_acc each sample
+uint16_t _mod_lfsr = 0;                     // PRBS9 state
+uint16_t _mod_bit = 0;                      // next pattern bit
+uint8_t _mod_hop = 0;                       // hop channel on the output
+
+uint8_t _mod_rx_state = MOD_RX_SYNC;
+uint8_t _mod_rx_count = 0;
+uint8_t _mod_rx_pos = 0;
+uint8_t _mod_rx_check = 0;
+volatile uint16_t _mod_rx_tick = 0;         // tick count when the last byte came in
+uint32_t _mod_frame[MOD_FRAME_MAX];
+
+volatile uint16_t mod_underruns = 0;
+volatile uint16_t mod_bad_frames = 0;
+volatile uint16_t mod_dropped_frames = 0;
+volatile uint16_t mod_late = 0;
+
+uint8_t mod_type = MOD_FM;
+uint8_t mod_shape = MOD_SHAPE_SINE;
+uint16_t mod_freq = MOD_FREQ_DEFAULT;
+uint32_t mod_deviation = MOD_DEVIATION_DEFAULT;
+uint16_t mod_depth = MOD_DEPTH_DEFAULT;
+uint8_t mod_psk_type = MOD_BPSK;
+uint8_t mod_key_source = MOD_KEY_PRBS;
+uint8_t mod_key_pattern[MOD_KEY_PATTERN_MAX] = {0xF9, 0xA8};    // Barker 13
+uint16_t mod_key_bits = 13;
+uint32_t mod_fsk_freq = MOD_FSK_FREQ_DEFAULT;
+uint32_t mod_hop_freqs[MOD_HOP_MAX];
+uint8_t mod_hop_count = 0;
+
+// QPSK phase offsets by symbol, Gray coded, in 2pi/4096
+const uint16_t _mod_qpsk_phase[4] PROGMEM = {0, 1024, 3072, 2048};
+
+uint32_t mod_set_rate(uint32_t rate)
+{
+    /*
+    This function picks the smallest TIMER2 prescaler that can reach a rate,
+    for the finest steps. Returns the rate it will really run at.
+    */
+
+    if (rate < MOD_RATE_MIN)
+    {
+        rate = MOD_RATE_MIN;
+    }
+    else if (rate > MOD_RATE_MAX)
+    {
+        rate = MOD_RATE_MAX;
+    }
+
+    for (uint8_t i = 0; i < 7; i++)
+    {
+        uint32_t prescale = pgm_read_word(&_mod_prescale[i]);
+        uint32_t counts = ((F_CPU / prescale) + (rate / 2)) / rate;
+
+        if (counts <= 256)
+        {
+            _mod_clock_select = i + 1;
+            _mod_compare = counts - 1;
+            _mod_rate = ((F_CPU / prescale) + (counts / 2)) / counts;
+            break;
+        }
+    }
+    return _mod_rate;
+}
+
+uint32_t mod_rate(void)
+{
+    if (_mod_rate == 0)
+    {
+        mod_set_rate(MOD_RATE_DEFAULT);
+    }
+    return _mod_rate;
+}
+
+uint8_t mod_active(void)
+{
+    /*
+    This function returns true from mod_stream_start() until mod_stop().
+    */
+
+    return (_mod_state != MOD_OFF);
+}
+
+uint8_t mod_state(void)
+{
+    return _mod_state;
+}
+
+void mod_stream_start(void)
+{
+    /*
+    This function starts streaming. The output must be on FREQ0/PHASE0, the
+    first samples go into FREQ1/PHASE1. From here the UART takes frames.
+    */
+
+    mod_rate();
+
+    _mod_head = 0;
+    _mod_tail = 0;
+    _mod_playing = 0;
+    _mod_xoff = 0;
+    _mod_freq_reg = 0;
+    _mod_phase_reg = 0;
+    _mod_rx_state = MOD_RX_SYNC;
+    _mod_rx_tick = event_tick_count;
+    mod_underruns = 0;
+    mod_bad_frames = 0;
+    mod_dropped_frames = 0;
+    mod_late = 0;
+
+    _mod_state = MOD_STREAM;
+    uart_set_rx_hook(mod_stream_rx);
+    hal_mod_timer_start(_mod_clock_select, _mod_compare);
+}
+
+void mod_wave_start(uint32_t carrier_tw, uint16_t carrier_phase)
+{
+    /*
+    This function starts wavetable FM or PM around the given carrier, using
+    the mod_ settings. The output must be on FREQ0/PHASE0.
+    */
+
+    int32_t peak;
+    int32_t offset;
+    int32_t value;
+
+    hal_mod_timer_stop();
+    mod_rate();
+
+    peak = (mod_type == MOD_FM) ? (int32_t)AD9833_freq_to_tw(mod_deviation) : mod_depth;
+    for (uint8_t i = 0; i < MOD_WAVE_LEN; i++)
+    {
+        offset = ((int64_t)(int8_t)pgm_read_byte(&_mod_waves[mod_shape][i]) * peak) / 127;
+        if (mod_type == MOD_FM)
+        {
+            value = (int32_t)carrier_tw + offset;
+            if (value < 0)
+            {
+                value = 0;
+            }
+            else if (value > (int32_t)AD9833_TW_MAX)
+            {
+                value = AD9833_TW_MAX;
+            }
+            _mod_ring[i] = ((uint32_t)MOD_WORD_FREQ << 28) | (uint32_t)value;
+        }
+        else
+        {
+            _mod_ring[i] = ((uint32_t)MOD_WORD_PHASE << 28) | ((carrier_phase + offset) & 0x0FFF);
+        }
+    }
+
+    // steps per sample, at most half a cycle
+    _mod_inc = ((uint64_t)mod_freq << 32) / _mod_rate;
+    if (_mod_inc > 0x80000000UL)
+    {
+        _mod_inc = 0x80000000UL;
+    }
+    _mod_acc = 0;
+    _mod_last = 0xFFFFFFFFUL;
+    _mod_freq_reg = 0;
+    _mod_phase_reg = 0;
+    mod_late = 0;
+
+    _mod_state = MOD_WAVE;
+    hal_mod_timer_start(_mod_clock_select, _mod_compare);
+}
+
+void mod_psk_start(uint16_t carrier_phase)
+{
+    /*
+    This function starts phase shift keying around the given carrier phase,
+    using the mod_psk_ settings, at one symbol per sample. The output must be
+    on FREQ0/PHASE0.
+    */
+
+    hal_mod_timer_stop();
+    mod_rate();
+
+    for (uint8_t i = 0; i < 4; i++)
+    {
+        _mod_ring[i] = ((uint32_t)MOD_WORD_PHASE << 28) | ((carrier_phase + pgm_read_word(&_mod_qpsk_phase[i])) & 0x0FFF);
+    }
+
+    // preload both phases, so a BPSK symbol is just a PSELECT change
+    AD9833_burst_begin();
+    AD9833_set_phase_reg(carrier_phase, 0);
+    AD9833_set_phase_reg(carrier_phase + 2048, 1);
+    AD9833_select_phase_reg(0);
+    AD9833_burst_end();
+
+    _mod_last = (mod_psk_type == MOD_QPSK) ? _mod_ring[0] : ((uint32_t)MOD_WORD_PSEL << 28);
+    _mod_lfsr = 0x1FF;
+    _mod_bit = 0;
+    _mod_freq_reg = 0;
+    _mod_phase_reg = 0;
+    mod_late = 0;
+
+    _mod_state = MOD_PSK;
+    hal_mod_timer_start(_mod_clock_select, _mod_compare);
+}
+
+void mod_fsk_start(uint32_t carrier_tw)
+{
+    /*
+    This function starts two tone FSK between the carrier, for a 0, and
+    mod_fsk_freq, for a 1, at one symbol per sample.
+    */
+
+    hal_mod_timer_stop();
+    mod_rate();
+
+    // preload both tones, so a symbol is just an FSELECT change
+    AD9833_burst_begin();
+    AD9833_set_tw(carrier_tw, 0);
+    AD9833_set_tw(AD9833_freq_to_tw(mod_fsk_freq), 1);
+    AD9833_select_freq_reg(0);
+    AD9833_burst_end();
+
+    _mod_last = ((uint32_t)MOD_WORD_FSEL << 28);
+    _mod_lfsr = 0x1FF;
+    _mod_bit = 0;
+    _mod_freq_reg = 0;
+    _mod_phase_reg = 0;
+    mod_late = 0;
+
+    _mod_state = MOD_FSK;
+    hal_mod_timer_start(_mod_clock_select, _mod_compare);
+}
+
+uint8_t mod_hop_start(void)
+{
+    /*
+    This function starts hopping through mod_hop_freqs, one channel per
+    sample. The first channel goes out at once and the second is loaded
+    ready. Returns false if the list is empty.
+    */
+
+    if (mod_hop_count == 0)
+    {
+        return 0;
+    }
+
+    hal_mod_timer_stop();
+    mod_rate();
+
+    for (uint8_t i = 0; i < mod_hop_count; i++)
+    {
+        _mod_ring[i] = AD9833_freq_to_tw(mod_hop_freqs[i]);
+    }
+
+    AD9833_burst_begin();
+    AD9833_set_tw(_mod_ring[0], 0);
+    AD9833_select_freq_reg(0);
+    AD9833_set_tw(_mod_ring[(mod_hop_count > 1) ? 1 : 0], 1);
+    AD9833_burst_end();
+
+    _mod_hop = 0;
+    _mod_freq_reg = 0;
+    _mod_phase_reg = 0;
+    mod_late = 0;
+
+    _mod_state = MOD_HOP;
+    hal_mod_timer_start(_mod_clock_select, _mod_compare);
+    return 1;
+}
+
+void mod_stop(void)
+{
+    /*
+    This function stops the engine and gives the UART back to text commands.
+    The caller puts the output back how it wants it.
+    */
+
+    hal_mod_timer_stop();
+    uart_set_rx_hook(0);
+    if (_mod_xoff)
+    {
+        uart_put_flow(UART_XON);
+        _mod_xoff = 0;
+    }
+    _mod_state = MOD_OFF;
+}
+
+uint8_t mod_poll(void)
+{
+    /*
+    This function is called from the main loop. It ends a stream whose host
+    has gone quiet. Returns true once the engine has stopped and the output
+    needs putting back.
+    */
+
+    uint8_t state = _mod_state;
+    uint16_t idle = 0;
+
+    if (state == MOD_STREAM)
+    {
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+        {
+            idle = event_tick_count - _mod_rx_tick;
+        }
+        if (idle >= MOD_IDLE_TICKS)
+        {
+            state = MOD_DONE;
+        }
+    }
+
+    if (state == MOD_DONE)
+    {
+        mod_stop();
+        return 1;
+    }
+    return 0;
+}
+
+void _mod_commit(void)
+{
+    /*
+    This function moves a checked frame into the ring. Interrupt context.
+    */
+
+    uint8_t head = _mod_head;
+    uint8_t fill = (head - _mod_tail) & (MOD_RING_LEN - 1);
+
+    if (_mod_rx_count > (MOD_RING_LEN - 1 - fill))
+    {
+        mod_dropped_frames += 1;
+        return;
+    }
+
+    for (uint8_t i = 0; i < _mod_rx_count; i++)
+    {
+        _mod_ring[head] = _mod_frame[i];
+        head = (head + 1) & (MOD_RING_LEN - 1);
+        fill += 1;
+
+        if ((_mod_frame[i] >> 28) == MOD_WORD_END)
+        {
+            // the rest of the line is text again, play out what is queued
+            uart_set_rx_hook(0);
+            _mod_state = MOD_DRAIN;
+            _mod_playing = 1;
+            break;
+        }
+    }
+    _mod_head = head;
+
+    if (fill >= (MOD_RING_LEN / 2))
+    {
+        _mod_playing = 1;
+    }
+    if ((fill >= MOD_XOFF_LEVEL) && !_mod_xoff && (_mod_state == MOD_STREAM))
+    {
+        uart_put_flow(UART_XOFF);
+        _mod_xoff = 1;
+    }
+}
+
+void mod_stream_rx(uint8_t data)
+{
+    /*
+    This function is the UART receive hook while streaming, it collects
+    frames a byte at a time. Anything outside a frame is skipped until the
+    next sync byte.
+    */
+
+    _mod_rx_tick = event_tick_count;
+
+    switch (_mod_rx_state)
+    {
+        case MOD_RX_SYNC:
+            if (data == MOD_SYNC)
+            {
+                _mod_rx_state = MOD_RX_COUNT;
+            }
+            break;
+
+        case MOD_RX_COUNT:
+            if ((data == 0) || (data > MOD_FRAME_MAX))
+            {
+                mod_bad_frames += 1;
+                _mod_rx_state = MOD_RX_SYNC;
+                break;
+            }
+            _mod_rx_count = data;
+            _mod_rx_pos = 0;
+            _mod_rx_check = data;
+            _mod_rx_state = MOD_RX_DATA;
+            break;
+
+        case MOD_RX_DATA:
+            if ((_mod_rx_pos & 3) == 0)
+            {
+                _mod_frame[_mod_rx_pos >> 2] = 0;
+            }
+            _mod_frame[_mod_rx_pos >> 2] |= (uint32_t)data << ((_mod_rx_pos & 3) * 8);
+            _mod_rx_check ^= data;
+            _mod_rx_pos += 1;
+            if (_mod_rx_pos == (_mod_rx_count * 4))
+            {
+                _mod_rx_state = MOD_RX_CHECK;
+            }
+            break;
+
+        case MOD_RX_CHECK:
+            _mod_rx_state = MOD_RX_SYNC;
+            if (data != _mod_rx_check)
+            {
+                mod_bad_frames += 1;
+                break;
+            }
+            _mod_commit();
+            break;
+    }
+}
+
+uint8_t _mod_write(uint32_t word)
+{
+    /*
+    This function puts one sample on the output, through whichever register
+    is not in use, and selects it under the same FSYNC. Interrupt context.
+    Returns false if the sample was dropped.
+    */
+
+    if (((word >> 28) != MOD_WORD_END) && spi_queued(SPI_PRIO_HIGH))
+    {
+        // the last sample is still on the bus, drop this one to keep to the timer
+        mod_late += 1;
+        return 0;
+    }
+
+    HAL_BENCH_BEGIN(mod_sample);
+    switch (word >> 28)
+    {
+        case MOD_WORD_FREQ:
+            _mod_freq_reg ^= 1;
+            AD9833_burst_begin();
+            AD9833_set_tw(word & AD9833_TW_MAX, _mod_freq_reg);
+            AD9833_select_freq_reg(_mod_freq_reg);
+            AD9833_burst_end();
+            break;
+
+        case MOD_WORD_PHASE:
+            _mod_phase_reg ^= 1;
+            AD9833_burst_begin();
+            AD9833_set_phase_reg(word, _mod_phase_reg);
+            AD9833_select_phase_reg(_mod_phase_reg);
+            AD9833_burst_end();
+            break;
+
+        case MOD_WORD_PSEL:
+            _mod_phase_reg = word & 1;
+            AD9833_select_phase_reg(_mod_phase_reg);
+            break;
+
+        case MOD_WORD_FSEL:
+            _mod_freq_reg = word & 1;
+            AD9833_select_freq_reg(_mod_freq_reg);
+            break;
+
+        case MOD_WORD_END:
+            hal_mod_timer_stop();
+            _mod_state = MOD_DONE;
+            event_put(EVENT_MODULATION, 0);
+            break;
+    }
+    _mod_last = word;
+    return 1;
+}
+
+uint8_t _mod_next_bit(void)
+{
+    /*
+    This function returns the next PSK or FSK data bit.
+    */
+
+    uint8_t bit;
+
+    if (mod_key_source == MOD_KEY_PRBS)
+    {
+        bit = ((_mod_lfsr >> 8) ^ (_mod_lfsr >> 4)) & 1;
+        _mod_lfsr = ((_mod_lfsr << 1) | bit) & 0x1FF;
+        return bit;
+    }
+
+    bit = (mod_key_pattern[_mod_bit >> 3] >> (7 - (_mod_bit & 7))) & 1;
+    _mod_bit += 1;
+    if (_mod_bit >= mod_key_bits)
+    {
+        _mod_bit = 0;
+    }
+    return bit;
+}
+
+void mod_step(void)
+{
+    /*
+    This function plays one sample. It is called from the TIMER2 interrupt.
+    */
+
+    uint8_t tail = _mod_tail;
+    uint8_t fill;
+    uint32_t word;
+
+    if (_mod_state == MOD_WAVE)
+    {
+        word = _mod_ring[_mod_acc >> MOD_WAVE_SHIFT];
+        _mod_acc += _mod_inc;
+        if (word != _mod_last)
+        {
+            _mod_write(word);
+        }
+        return;
+    }
+
+    if (_mod_state == MOD_FSK)
+    {
+        word = ((uint32_t)MOD_WORD_FSEL << 28) | _mod_next_bit();
+        if (word != _mod_last)
+        {
+            _mod_write(word);
+        }
+        return;
+    }
+
+    if (_mod_state == MOD_HOP)
+    {
+        uint8_t next;
+
+        // the next channel is already in the other register, switch to it
+        if (!_mod_write(((uint32_t)MOD_WORD_FSEL << 28) | (_mod_freq_reg ^ 1)))
+        {
+            return;
+        }
+        _mod_hop = (_mod_hop + 1 < mod_hop_count) ? (_mod_hop + 1) : 0;
+
+        // and load the one after into the register just left
+        next = (_mod_hop + 1 < mod_hop_count) ? (_mod_hop + 1) : 0;
+        AD9833_burst_begin();
+        AD9833_set_tw(_mod_ring[next], _mod_freq_reg ^ 1);
+        AD9833_burst_end();
+        return;
+    }
+
+    if (_mod_state == MOD_PSK)
+    {
+        uint8_t symbol = _mod_next_bit();
+
+        if (mod_psk_type == MOD_QPSK)
+        {
+            symbol = (symbol << 1) | _mod_next_bit();
+            word = _mod_ring[symbol];
+        }
+        else
+        {
+            word = ((uint32_t)MOD_WORD_PSEL << 28) | symbol;
+        }
+        if (word != _mod_last)
+        {
+            _mod_write(word);
+        }
+        return;
+    }
+
+    if (!_mod_playing)
+    {
+        return;
+    }
+    if (tail == _mod_head)
+    {
+        if (_mod_state == MOD_STREAM)
+        {
+            mod_underruns += 1;
+            _mod_playing = 0;               // wait for the ring to fill again
+        }
+        return;
+    }
+
+    word = _mod_ring[tail];
+    _mod_tail = (tail + 1) & (MOD_RING_LEN - 1);
+
+    fill = (_mod_head - _mod_tail) & (MOD_RING_LEN - 1);
+    if (_mod_xoff && (fill <= MOD_XON_LEVEL))
+    {
+        uart_put_flow(UART_XON);
+        _mod_xoff = 0;
+    }
+
+    _mod_write(word);
+}
+
+ISR(TIMER2_COMPA_vect)
+{
+    /*
+    Modulation timer interrupt.
+    */
+
+    HAL_BENCH_BEGIN(mod_step);
+    mod_step();
+    HAL_BENCH_END(mod_step);
+}
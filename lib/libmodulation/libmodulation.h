@@ -0,0 +1,158 @@
+/* 
+ * This file is part of the BASE-4 distribution (website).
+ * Copyright (c) 2018 Tim Buchanan.
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef LIBMODULATION_H
+#define LIBMODULATION_H
+
+// Modulation engine. TIMER2 clocks samples out to the AD9833 at a fixed rate.
+// Each new frequency or phase goes into the inactive register, which is then
+// selected under the same FSYNC, so the output always switches between two
+// complete values. The engine and the sweep share FREQ1, only one can run.
+//
+// Streaming: the host sends samples over the UART in binary frames
+//
+//     0xA5, n (1 to MOD_FRAME_MAX), n words (4 bytes each, little endian), check
+//
+// where check is the XOR of n and every word byte. Each word is one sample,
+// the top 4 bits say what it is (MOD_WORD_). Good frames go into a ring that
+// the timer plays from. Play starts once the ring is half full, so one half
+// can be refilled while the other plays, and starts again the same way after
+// an underrun. XOFF is sent when the ring is getting full and XON when it has
+// drained. An end word returns the UART to text commands, and the engine
+// stops once everything before it has played.
+//
+// Wavetable modulation: a 32 bit phase accumulator steps through a 64 point
+// modulating waveform (MOD_SHAPE_) at mod_freq. At start the waveform is
+// turned into frequency (FM) or phase (PM) words around the carrier, held
+// in the stream ring, so each sample is a table lookup and one register
+// update. Samples the same as the last are not sent.
+//
+// Phase shift keying: one symbol per sample, from a PRBS9 generator or a
+// bit pattern, MSB first. For BPSK PHASE0 and PHASE1 are loaded with the
+// carrier phase and the carrier phase + 180 degrees at start, so a symbol
+// change is a single control word flipping PSELECT. QPSK (Gray coded, 00 =
+// 0, 01 = 90, 11 = 180, 10 = 270 degrees) needs a new phase word too, sent
+// through the inactive register like PM.
+//
+// FSK: FREQ0 holds the carrier and FREQ1 the other tone, so a symbol change
+// is a single control word flipping FSELECT. Symbols come from the same
+// source as PSK.
+//
+// Frequency hopping: each sample moves to the next channel of a list. The
+// next channel is always waiting in the inactive register, so the hop
+// itself is one control word at the timer instant, and the channel after
+// is written into the register just left while this one dwells.
+
+// MOD_RATE_MAX is where the rate setting stops. It has not been measured
+// yet. make mod in tools/bench times every sample of an AVR build, and fails
+// if the highest rate the engine keeps up with is below MOD_RATE_MAX. Set it
+// from that run's max_rate. make psk does the same with only BPSK and QPSK
+// running, its max_rate and jitter_us are the PSK symbol figures. The bus
+// alone is not the limit: the worst sample (both halves of a tuning word and
+// a control word) is 6 SPI bytes, 96 CPU cycles at fosc/2, against 800
+// cycles a sample at 20000.
+
+#define MOD_RATE_MIN            62UL        // samples per second, F_CPU / (1024 * 256)
+#define MOD_RATE_MAX            20000UL     // not a measured limit, see above
+#define MOD_RATE_DEFAULT        1000UL
+
+#define MOD_RING_LEN            128         // samples, must be a power of 2
+#define MOD_FRAME_MAX           16          // words per frame
+#define MOD_XOFF_LEVEL          (MOD_RING_LEN / 2)
+#define MOD_XON_LEVEL           (MOD_RING_LEN / 4)
+#define MOD_IDLE_TICKS          67          // about 2 seconds with no frames ends a stream
+
+#define MOD_WAVE_LEN            64          // points in a modulating waveform
+#define MOD_WAVE_SHIFT          26          // accumulator bits below the table index
+
+// modulation types
+#define MOD_FM                  0           // mod_deviation is the peak change in Hz
+#define MOD_PM                  1           // mod_depth is the peak change in 2pi/4096
+
+// modulating waveforms
+#define MOD_SHAPE_SINE          0
+#define MOD_SHAPE_TRI           1
+#define MOD_SHAPE_SQUARE        2
+
+#define MOD_FREQ_DEFAULT        100         // Hz
+#define MOD_DEVIATION_DEFAULT   1000        // Hz
+#define MOD_DEPTH_DEFAULT       1024        // 90 degrees
+#define MOD_DEPTH_MAX           2048        // 180 degrees
+
+#define MOD_FSK_FREQ_DEFAULT    1000        // Hz
+#define MOD_HOP_MAX             16          // channels in the hop list
+
+// PSK types and symbol sources
+#define MOD_BPSK                0
+#define MOD_QPSK                1
+#define MOD_KEY_PRBS            0           // PRBS9, x^9 + x^5 + 1
+#define MOD_KEY_PATTERN         1           // mod_key_pattern, repeated
+
+#define MOD_KEY_PATTERN_MAX     32          // bytes
+
+#define MOD_SYNC                0xA5
+#define MOD_WORD_FREQ           0x0         // bits 27..0 are a tuning word
+#define MOD_WORD_PHASE          0x1         // bits 11..0 are a phase, 2pi/4096
+#define MOD_WORD_PSEL           0x2         // bit 0 selects PHASE0 or PHASE1, no write
+#define MOD_WORD_FSEL           0x3         // bit 0 selects FREQ0 or FREQ1, no write
+#define MOD_WORD_END            0xF         // end of stream
+
+// engine states
+#define MOD_OFF                 0
+#define MOD_STREAM              1           // frames are being received
+#define MOD_DRAIN               2           // end received, playing what is left
+#define MOD_DONE                3           // stopped, waiting for mod_poll()
+#define MOD_WAVE                4           // wavetable FM or PM
+#define MOD_PSK                 5           // phase shift keying
+#define MOD_FSK                 6           // two tone frequency shift keying
+#define MOD_HOP                 7           // frequency hopping
+
+extern uint8_t mod_type;
+extern uint8_t mod_shape;
+extern uint16_t mod_freq;                   // modulating frequency, Hz
+extern uint32_t mod_deviation;
+extern uint16_t mod_depth;
+extern uint8_t mod_psk_type;
+extern uint8_t mod_key_source;
+extern uint8_t mod_key_pattern[MOD_KEY_PATTERN_MAX];
+extern uint16_t mod_key_bits;               // pattern length
+extern uint32_t mod_fsk_freq;               // FSK tone for a 1, Hz
+extern uint32_t mod_hop_freqs[MOD_HOP_MAX]; // hop channels, Hz
+extern uint8_t mod_hop_count;
+
+extern volatile uint16_t mod_underruns;     // samples due with the ring empty
+extern volatile uint16_t mod_bad_frames;    // bad length or check byte
+extern volatile uint16_t mod_dropped_frames;    // no room in the ring
+extern volatile uint16_t mod_late;          // samples skipped as the SPI bus was still busy
+
+// prototypes
+
+uint32_t mod_set_rate(uint32_t rate);
+uint32_t mod_rate(void);
+uint8_t mod_active(void);
+uint8_t mod_state(void);
+void mod_stream_start(void);
+void mod_wave_start(uint32_t carrier_tw, uint16_t carrier_phase);
+void mod_psk_start(uint16_t carrier_phase);
+void mod_fsk_start(uint32_t carrier_tw);
+uint8_t mod_hop_start(void);
+void mod_stream_rx(uint8_t data);
+void mod_stop(void);
+uint8_t mod_poll(void);
+void mod_step(void);
+
+#endif /* LIBMODULATION_H */
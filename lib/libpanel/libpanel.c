@@ -0,0 +1,163 @@
+/* 
+ * This file is part of the BASE-4 distribution (website).
+ * Copyright (c) 2018 Tim Buchanan.
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "hal.h"
+#include "libpanel.h"
+#include "libevent.h"
+#include "globals.h"
+
+// front panel inputs, one bit each, 1 = active. The polled inputs are
+// debounced together by a 2 bit vertical counter, an input must read the same
+// for 4 ticks to change. The OE switch instead wakes the CPU with a pin change
+// interrupt: the first edge is taken at once and the pin is then ignored for
+// PANEL_LOCKOUT_TICKS while it bounces. Changes are reported through the
+// event queue.
+uint8_t _panel_state = 0;                   // debounced inputs
+uint8_t _panel_ct0 = 0xFF;                  // vertical counter, bit 0
+uint8_t _panel_ct1 = 0xFF;                  // vertical counter, bit 1
+uint8_t _panel_held_ticks = 0;              // ticks the pushbutton has been held
+uint8_t _panel_lockout = 0;                 // ticks until the OE switch is watched again
+
+uint8_t _panel_read_raw(void)
+{
+    /*
+    This function reads every front panel input, active high.
+    */
+
+    uint8_t raw = 0;
+
+    if (!(hal_encoder_pins() & (1 << ROT_END_PB)))
+    {
+        raw |= PANEL_PB;                    // pushbutton pulls low
+    }
+    if (hal_switch_pins() & (1 << OUTPUT_ENABLE_SW))
+    {
+        raw |= PANEL_OE;
+    }
+    return raw;
+}
+
+void _panel_report(uint8_t changed)
+{
+    /*
+    This function applies debounced changes and queues their events.
+    */
+
+    _panel_state ^= changed;
+    if (_panel_state & changed)
+    {
+        event_put(EVENT_PRESS, _panel_state & changed);
+    }
+    if (~_panel_state & changed)
+    {
+        event_put(EVENT_RELEASE, ~_panel_state & changed);
+    }
+}
+
+void _panel_switch_check(void)
+{
+    /*
+    This function takes a change of the OE switch and locks it out while it
+    bounces. Interrupt context only.
+    */
+
+    uint8_t changed = (_panel_state ^ _panel_read_raw()) & PANEL_OE;
+
+    if (changed)
+    {
+        _panel_report(changed);
+        hal_switch_irq(0);
+        _panel_lockout = PANEL_LOCKOUT_TICKS;
+    }
+}
+
+void panel_init(void)
+{
+    /*
+    This function takes the current inputs as the debounced state, so nothing
+    is reported for switches already on at power up.
+    */
+
+    _panel_state = _panel_read_raw();
+    _panel_ct0 = 0xFF;
+    _panel_ct1 = 0xFF;
+    _panel_held_ticks = 0;
+    _panel_lockout = 0;
+    hal_switch_init();
+}
+
+void panel_sample(void)
+{
+    /*
+    This function samples and debounces the front panel inputs, and queues
+    press, release and long press events. It is called from the tick interrupt.
+    */
+
+    uint8_t changed = (_panel_state ^ _panel_read_raw()) & PANEL_POLLED;
+
+    // count the inputs that differ from the debounced state, reset the rest
+    _panel_ct0 = ~(_panel_ct0 & changed);
+    _panel_ct1 = _panel_ct0 ^ (_panel_ct1 & changed);
+    changed &= _panel_ct0 & _panel_ct1;     // counters that rolled over
+    _panel_report(changed);
+
+    // watch the OE switch again once it has settled, catching any change made
+    // while it was locked out
+    if (_panel_lockout)
+    {
+        _panel_lockout -= 1;
+        if (_panel_lockout == 0)
+        {
+            hal_switch_irq(1);
+            _panel_switch_check();
+        }
+    }
+
+    if (_panel_state & PANEL_PB)
+    {
+        if (_panel_held_ticks < PANEL_LONG_TICKS)
+        {
+            _panel_held_ticks += 1;
+            if (_panel_held_ticks == PANEL_LONG_TICKS)
+            {
+                event_put(EVENT_LONG_PRESS, PANEL_PB);
+            }
+        }
+    }
+    else
+    {
+        _panel_held_ticks = 0;
+    }
+}
+
+uint8_t panel_state(void)
+{
+    /*
+    This function returns the debounced state of every input.
+    */
+
+    return _panel_state;
+}
+
+ISR(PCINT1_vect)
+{
+    /*
+    Output enable switch pin change interrupt.
+    */
+
+    _panel_switch_check();
+}
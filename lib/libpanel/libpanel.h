@@ -0,0 +1,28 @@
+/* 
+ * This file is part of the BASE-4 distribution (website).
+ * Copyright (c) 2018 Tim Buchanan.
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#define PANEL_PB                (1 << 0)    // rotary encoder pushbutton, 1 = pressed
+#define PANEL_OE                (1 << 1)    // output enable switch, 1 = output on
+#define PANEL_POLLED            PANEL_PB    // inputs debounced by sampling each tick
+#define PANEL_LONG_TICKS        33          // about 1 second
+#define PANEL_LOCKOUT_TICKS     4           // the OE switch is ignored this long after it changes
+
+// prototypes
+
+void panel_init(void);
+void panel_sample(void);
+uint8_t panel_state(void);
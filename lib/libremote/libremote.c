@@ -0,0 +1,1292 @@
+/* 
+ * This file is part of the BASE-4 distribution (website).
+ * Copyright (c) 2018 Tim Buchanan.
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <string.h>
+#include "hal.h"
+#include "libremote.h"
+#include "libuart.h"
+#include "libevent.h"
+#include "libsched.h"
+#include "libbase4.h"
+#include "libad9833.h"
+#include "libmodulation.h"
+#include "globals.h"
+
+// headers, one per line in REMOTE_ order. The upper case part is the short form
+const char _remote_headers[] PROGMEM =
+    "*IDN\n*RST\n*CLS\n*OPC\nFREQuency\nPHASe\nFUNCtion\n"
+    "SWEep:STARt\nSWEep:STOP\nSWEep:TIME\nSWEep:SPACing\nSWEep:STATe\n"
+    "SYSTem:ERRor\nSYSTem:LATency\n"
+    "STReam:RATE\nSTReam:STATe\nSTReam:COUNt\n"
+    "MODulation:TYPE\nMODulation:FUNCtion\nMODulation:FREQuency\nMODulation:DEViation\n"
+    "MODulation:DEPTh\nMODulation:SRATe\nMODulation:STATe\n"
+    "PSK:TYPE\nPSK:SOURce\nPSK:DATA\nPSK:BAUD\nPSK:STATe\n"
+    "FSK:FREQuency\nFSK:SOURce\nFSK:DATA\nFSK:BAUD\nFSK:STATe\n"
+    "HOP:LIST\nHOP:APPend\nHOP:RATE\nHOP:STATe\n"
+    "SWEep:ACTual\n";
+
+char _remote_line[REMOTE_LINE_MAX];         // the line being received
+uint8_t _remote_len = 0;
+uint8_t _remote_in_line = 0;                // true once a line has started
+uint8_t _remote_overrun = 0;                // true if the line was too long
+uint16_t _remote_rx_errors = 0;             // uart_rx_errors when last looked at
+uint8_t _remote_replies = 0;                // query replies sent for this line
+int16_t _remote_errors[REMOTE_ERRORS];
+uint8_t _remote_error_count = 0;
+uint32_t remote_latency_last = 0;           // microseconds from line end to done
+uint32_t remote_latency_max = 0;
+
+void remote_init(void)
+{
+    /*
+    This function starts the UART for remote control.
+    */
+
+    uart_init();
+}
+
+void _remote_error(int16_t code)
+{
+    /*
+    This function adds an error to the queue. If it is full the newest entry
+    becomes a queue overflow error.
+    */
+
+    if (_remote_error_count < REMOTE_ERRORS)
+    {
+        _remote_errors[_remote_error_count++] = code;
+    }
+    else
+    {
+        _remote_errors[REMOTE_ERRORS - 1] = REMOTE_ERR_OVERFLOW;
+    }
+}
+
+const char *_remote_error_text(int16_t code)
+{
+    switch (code)
+    {
+        case REMOTE_ERR_NONE:       return PSTR("No error");
+        case REMOTE_ERR_DATA_TYPE:  return PSTR("Data type error");
+        case REMOTE_ERR_PARAM:      return PSTR("Parameter not allowed");
+        case REMOTE_ERR_MISSING:    return PSTR("Missing parameter");
+        case REMOTE_ERR_HEADER:     return PSTR("Undefined header");
+        case REMOTE_ERR_CONFLICT:   return PSTR("Settings conflict");
+        case REMOTE_ERR_RANGE:      return PSTR("Data out of range");
+        case REMOTE_ERR_OVERFLOW:   return PSTR("Queue overflow");
+        case REMOTE_ERR_OVERRUN:    return PSTR("Input buffer overrun");
+    }
+    return PSTR("Error");
+}
+
+void _remote_reply(void)
+{
+    /*
+    This function starts a query reply, separating it from the last one.
+    */
+
+    if (_remote_replies)
+    {
+        uart_putc(';');
+    }
+    _remote_replies += 1;
+}
+
+uint8_t _remote_match(const char *pattern, const char *input, uint8_t len)
+{
+    /*
+    This function compares an upper case header against one pattern from a
+    PROGMEM list, node by node. Each input node must be the pattern node's
+    short form or its whole word.
+    */
+
+    while (1)
+    {
+        uint8_t full = 0;
+        uint8_t brief = 0;
+        uint8_t n = 0;
+        char c;
+
+        while (((c = pgm_read_byte(pattern + full)) != ':') && (c != '\n'))
+        {
+            if ((full == brief) && !((c >= 'a') && (c <= 'z')))
+            {
+                brief += 1;
+            }
+            full += 1;
+        }
+        while ((n < len) && (input[n] != ':'))
+        {
+            n += 1;
+        }
+
+        if ((n != brief) && (n != full))
+        {
+            return 0;
+        }
+        for (uint8_t i = 0; i < n; i++)
+        {
+            c = pgm_read_byte(pattern + i);
+            if ((c >= 'a') && (c <= 'z'))
+            {
+                c -= 'a' - 'A';
+            }
+            if (c != input[i])
+            {
+                return 0;
+            }
+        }
+
+        pattern += full;
+        input += n;
+        len -= n;
+        if (pgm_read_byte(pattern) == '\n')
+        {
+            return (len == 0);
+        }
+        if (len == 0)
+        {
+            return 0;
+        }
+        pattern += 1;                       // step over the ':' in both
+        input += 1;
+        len -= 1;
+    }
+}
+
+int8_t _remote_lookup(const char *list, const char *input, uint8_t len)
+{
+    /*
+    This function returns the position of input in a PROGMEM list of
+    newline ended patterns, or -1 if it isn't there.
+    */
+
+    int8_t index = 0;
+
+    while (pgm_read_byte(list))
+    {
+        if (_remote_match(list, input, len))
+        {
+            return index;
+        }
+        while (pgm_read_byte(list++) != '\n');
+        index += 1;
+    }
+    return -1;
+}
+
+uint8_t _remote_parse_number(const char *s, uint32_t *value, uint8_t unit)
+{
+    /*
+    This function reads a decimal number with an optional fraction and unit
+    suffix (HZ, KHZ or MHZ for frequencies, MS or S for times) and rounds it
+    to a whole number of the base unit. Returns false if it isn't one.
+    */
+
+    uint64_t mantissa = 0;
+    uint32_t divisor = 1;
+    uint32_t multiplier = 0;
+    uint8_t digits = 0;
+
+    for (; (*s >= '0') && (*s <= '9'); s++, digits++)
+    {
+        mantissa = (mantissa * 10) + (*s - '0');
+        if (mantissa > 0xFFFFFFFFUL)
+        {
+            return 0;
+        }
+    }
+    if (*s == '.')
+    {
+        for (s++; (*s >= '0') && (*s <= '9'); s++, digits++)
+        {
+            if (divisor < 1000000UL)        // finer than a microunit is ignored
+            {
+                mantissa = (mantissa * 10) + (*s - '0');
+                divisor *= 10;
+            }
+        }
+    }
+    if (digits == 0)
+    {
+        return 0;
+    }
+
+    if (*s == 0)
+    {
+        multiplier = 1;
+    }
+    else if (unit == REMOTE_UNIT_HZ)
+    {
+        int8_t suffix = _remote_lookup(PSTR("HZ\nKHZ\nMHZ\n"), s, strlen(s));
+
+        multiplier = (suffix == 0) ? 1 : (suffix == 1) ? 1000UL : (suffix == 2) ? 1000000UL : 0;
+    }
+    else if (unit == REMOTE_UNIT_MS)
+    {
+        int8_t suffix = _remote_lookup(PSTR("MS\nS\n"), s, strlen(s));
+
+        multiplier = (suffix == 0) ? 1 : (suffix == 1) ? 1000UL : 0;
+    }
+    if (multiplier == 0)
+    {
+        return 0;
+    }
+
+    // a long fraction with a big unit could wrap the multiply below, anything
+    // this big is out of range anyway
+    if (mantissa > ((0x100000000ULL * divisor) / multiplier))
+    {
+        return 0;
+    }
+
+    mantissa = ((mantissa * multiplier) + (divisor / 2)) / divisor;
+    if (mantissa > 0xFFFFFFFFUL)
+    {
+        return 0;
+    }
+    *value = mantissa;
+    return 1;
+}
+
+uint8_t _remote_streaming(void)
+{
+    /*
+    This function returns true if the modulation engine is playing a stream
+    rather than one of its built in modes.
+    */
+
+    return (mod_state() >= MOD_STREAM) && (mod_state() <= MOD_DONE);
+}
+
+uint8_t _remote_engine_start(uint8_t state)
+{
+    /*
+    This function starts (or restarts) one of the built in modulation engine
+    modes. Returns false if it can't run with the settings it has.
+    */
+
+    switch (state)
+    {
+        case MOD_WAVE:
+            start_modulation();
+            return 1;
+
+        case MOD_PSK:
+            start_psk();
+            return 1;
+
+        case MOD_FSK:
+            start_fsk();
+            return 1;
+
+        case MOD_HOP:
+            return start_hop();
+    }
+    return 0;
+}
+
+void _remote_engine_state(uint8_t state, int8_t choice)
+{
+    /*
+    This function turns a built in modulation engine mode on or off. Only
+    one mode can run at a time, and none during a sweep.
+    */
+
+    if (choice < 0)
+    {
+        _remote_error(REMOTE_ERR_DATA_TYPE);
+    }
+    else if ((choice & 1) && (is_sweep_started || (mod_active() && (mod_state() != state))))
+    {
+        _remote_error(REMOTE_ERR_CONFLICT);
+    }
+    else if (choice & 1)
+    {
+        if (!_remote_engine_start(state))
+        {
+            _remote_error(REMOTE_ERR_CONFLICT);
+        }
+    }
+    else if (mod_state() == state)
+    {
+        stop_modulation();
+    }
+}
+
+void _remote_mod_changed(void)
+{
+    /*
+    This function restarts a running built in modulation engine mode with
+    new settings. If they no longer make sense it is stopped.
+    */
+
+    if (mod_active() && !_remote_streaming() && !_remote_engine_start(mod_state()))
+    {
+        stop_modulation();
+        _remote_error(REMOTE_ERR_CONFLICT);
+    }
+}
+
+uint8_t _remote_parse_pattern(const char *s)
+{
+    /*
+    This function sets the PSK pattern from #H hex or #B binary digits. Hex
+    is assumed with no prefix. Returns false, leaving the pattern alone, if
+    the digits are bad or too many.
+    */
+
+    uint8_t pattern[MOD_KEY_PATTERN_MAX];
+    uint8_t width = 4;
+    uint16_t bits = 0;
+    uint8_t digit;
+
+    if ((s[0] == '#') && ((s[1] == 'H') || (s[1] == 'B')))
+    {
+        width = (s[1] == 'B') ? 1 : 4;
+        s += 2;
+    }
+
+    memset(pattern, 0, sizeof(pattern));
+    for (; *s; s++)
+    {
+        if ((*s >= '0') && (*s <= '9'))
+        {
+            digit = *s - '0';
+        }
+        else if ((*s >= 'A') && (*s <= 'F'))
+        {
+            digit = *s - 'A' + 10;
+        }
+        else
+        {
+            return 0;
+        }
+        if ((digit >> width) || ((bits + width) > (MOD_KEY_PATTERN_MAX * 8)))
+        {
+            return 0;
+        }
+
+        for (int8_t b = width - 1; b >= 0; b--, bits++)
+        {
+            if (digit & (1 << b))
+            {
+                pattern[bits >> 3] |= 0x80 >> (bits & 7);
+            }
+        }
+    }
+    if (bits == 0)
+    {
+        return 0;
+    }
+
+    memcpy(mod_key_pattern, pattern, sizeof(pattern));
+    mod_key_bits = bits;
+    return 1;
+}
+
+uint8_t _remote_parse_hops(const char *s, uint8_t append)
+{
+    /*
+    This function sets or adds to the hop list from comma separated
+    frequencies. The list is left alone if any of them are bad. Returns
+    false on an error.
+    */
+
+    uint32_t freqs[MOD_HOP_MAX];
+    uint8_t count = append ? mod_hop_count : 0;
+    char item[16];
+    uint8_t len;
+
+    memcpy(freqs, mod_hop_freqs, count * sizeof(freqs[0]));
+    while (1)
+    {
+        while (*s == ' ')
+        {
+            s++;
+        }
+        for (len = 0; *s && (*s != ',') && (len < (sizeof(item) - 1)); len++)
+        {
+            item[len] = *s++;
+        }
+        while ((len > 0) && (item[len - 1] == ' '))
+        {
+            len--;
+        }
+        item[len] = 0;
+
+        if (count == MOD_HOP_MAX)
+        {
+            _remote_error(REMOTE_ERR_RANGE);        // too many channels
+            return 0;
+        }
+        if (((*s != 0) && (*s != ',')) || !_remote_parse_number(item, &freqs[count], REMOTE_UNIT_HZ))
+        {
+            _remote_error(REMOTE_ERR_DATA_TYPE);
+            return 0;
+        }
+        if ((freqs[count] < 1) || (freqs[count] > MAX_FREQ))
+        {
+            _remote_error(REMOTE_ERR_RANGE);
+            return 0;
+        }
+        count++;
+
+        if (*s++ == 0)
+        {
+            break;
+        }
+    }
+
+    memcpy(mod_hop_freqs, freqs, count * sizeof(freqs[0]));
+    mod_hop_count = count;
+    return 1;
+}
+
+void _remote_put_milli(uint64_t value)
+{
+    /*
+    This function sends a value given in thousandths with three decimal places.
+    */
+
+    uint16_t fraction = value % 1000;
+
+    uart_put_uint(value / 1000);
+    uart_putc('.');
+    uart_putc('0' + (fraction / 100));
+    uart_putc('0' + ((fraction / 10) % 10));
+    uart_putc('0' + (fraction % 10));
+}
+
+void _remote_put_pattern(void)
+{
+    /*
+    This function sends the PSK pattern, in hex if it is whole hex digits.
+    */
+
+    uint8_t width = (mod_key_bits & 3) ? 1 : 4;
+    uint8_t digit;
+
+    uart_putc('#');
+    uart_putc((width == 4) ? 'H' : 'B');
+    for (uint16_t bit = 0; bit < mod_key_bits; bit += width)
+    {
+        digit = 0;
+        for (uint8_t b = 0; b < width; b++)
+        {
+            digit = (digit << 1) | ((mod_key_pattern[(bit + b) >> 3] >> (7 - ((bit + b) & 7))) & 1);
+        }
+        uart_putc((digit < 10) ? ('0' + digit) : ('A' + digit - 10));
+    }
+}
+
+void _remote_sweep_changed(uint8_t mode)
+{
+    /*
+    This function restarts a running sweep with new settings, in mode. The
+    sweep interrupt reads the mode, so while a sweep runs it is only changed
+    by start_sweep(), with the timer stopped.
+    */
+
+    if (is_sweep_started)
+    {
+        start_sweep(mode);
+    }
+    else
+    {
+        sweep_mode = mode;
+    }
+    update_display();
+}
+
+uint8_t _remote_waveform(void)
+{
+    /*
+    This function returns the waveform the AD9833 is set to.
+    */
+
+    uint16_t ctrl = AD9833_get_ctrl_reg();
+
+    if (ctrl & (1 << OPBITEN))
+    {
+        return FUNC_SQUARE;
+    }
+    if (ctrl & (1 << MODE))
+    {
+        return FUNC_TRI;
+    }
+    return FUNC_SINE;
+}
+
+void _remote_query(uint8_t command)
+{
+    /*
+    This function answers a query.
+    */
+
+    int16_t code;
+    sweep_timebase_t timebase;
+
+    _remote_reply();
+
+    switch (command)
+    {
+        case REMOTE_IDN_Q:
+            uart_puts_P(PSTR(REMOTE_IDN));
+            break;
+
+        case REMOTE_OPC:
+            uart_putc('1');
+            break;
+
+        case REMOTE_FREQ:
+            uart_put_uint(frequency);
+            break;
+
+        case REMOTE_PHAS:
+            uart_put_uint(phase);
+            break;
+
+        case REMOTE_FUNC:
+            code = _remote_waveform();
+            uart_puts_P((code == FUNC_TRI) ? PSTR("TRI") : (code == FUNC_SQUARE) ? PSTR("SQU") : PSTR("SIN"));
+            break;
+
+        case REMOTE_SWE_STAR:
+            uart_put_uint(sweep_start_freq);
+            break;
+
+        case REMOTE_SWE_STOP:
+            uart_put_uint(sweep_stop_freq);
+            break;
+
+        case REMOTE_SWE_TIME:
+            uart_put_uint(sweep_time);
+            break;
+
+        case REMOTE_SWE_ACT:
+            sweep_plan(sweep_time, &timebase);
+            uart_put_uint(timebase.steps);
+            uart_putc(',');
+            _remote_put_milli(((timebase.cycles * 1000UL) + ((F_CPU / 1000000UL) * timebase.steps / 2)) /
+                              ((F_CPU / 1000000UL) * timebase.steps));
+            uart_putc(',');
+            _remote_put_milli((timebase.cycles + (F_CPU / 2000000UL)) / (F_CPU / 1000000UL));
+            break;
+
+        case REMOTE_SWE_SPAC:
+            uart_puts_P((sweep_mode == FUNC_LOG_SWEEP) ? PSTR("LOG") : PSTR("LIN"));
+            break;
+
+        case REMOTE_SWE_STAT:
+            uart_putc(is_sweep_started ? '1' : '0');
+            break;
+
+        case REMOTE_SYST_ERR:
+            code = REMOTE_ERR_NONE;
+            if (_remote_error_count)
+            {
+                code = _remote_errors[0];
+                _remote_error_count -= 1;
+                memmove(&_remote_errors[0], &_remote_errors[1], _remote_error_count * sizeof(_remote_errors[0]));
+            }
+            uart_put_int(code);
+            uart_puts_P(PSTR(",\""));
+            uart_puts_P(_remote_error_text(code));
+            uart_putc('"');
+            break;
+
+        case REMOTE_SYST_LAT:
+            uart_put_uint(remote_latency_last);
+            uart_putc(',');
+            uart_put_uint(remote_latency_max);
+            break;
+
+        case REMOTE_STR_RATE:
+        case REMOTE_MOD_SRAT:
+        case REMOTE_PSK_BAUD:
+        case REMOTE_FSK_BAUD:
+        case REMOTE_HOP_RATE:
+            uart_put_uint(mod_rate());
+            break;
+
+        case REMOTE_STR_STAT:
+            uart_putc(_remote_streaming() ? '1' : '0');
+            break;
+
+        case REMOTE_STR_COUN:
+            uart_put_uint(mod_underruns);
+            uart_putc(',');
+            uart_put_uint(mod_bad_frames);
+            uart_putc(',');
+            uart_put_uint(mod_dropped_frames);
+            uart_putc(',');
+            uart_put_uint(mod_late);
+            break;
+
+        case REMOTE_MOD_TYPE:
+            uart_puts_P((mod_type == MOD_PM) ? PSTR("PM") : PSTR("FM"));
+            break;
+
+        case REMOTE_MOD_FUNC:
+            uart_puts_P((mod_shape == MOD_SHAPE_TRI) ? PSTR("TRI") : (mod_shape == MOD_SHAPE_SQUARE) ? PSTR("SQU") : PSTR("SIN"));
+            break;
+
+        case REMOTE_MOD_FREQ:
+            uart_put_uint(mod_freq);
+            break;
+
+        case REMOTE_MOD_DEV:
+            uart_put_uint(mod_deviation);
+            break;
+
+        case REMOTE_MOD_DEPT:
+            uart_put_uint(mod_depth);
+            break;
+
+        case REMOTE_MOD_STAT:
+            uart_putc((mod_state() == MOD_WAVE) ? '1' : '0');
+            break;
+
+        case REMOTE_PSK_TYPE:
+            uart_puts_P((mod_psk_type == MOD_QPSK) ? PSTR("QPSK") : PSTR("BPSK"));
+            break;
+
+        case REMOTE_PSK_SOUR:
+        case REMOTE_FSK_SOUR:
+            uart_puts_P((mod_key_source == MOD_KEY_PATTERN) ? PSTR("PATT") : PSTR("PRBS"));
+            break;
+
+        case REMOTE_PSK_DATA:
+        case REMOTE_FSK_DATA:
+            _remote_put_pattern();
+            break;
+
+        case REMOTE_PSK_STAT:
+            uart_putc((mod_state() == MOD_PSK) ? '1' : '0');
+            break;
+
+        case REMOTE_FSK_FREQ:
+            uart_put_uint(mod_fsk_freq);
+            break;
+
+        case REMOTE_FSK_STAT:
+            uart_putc((mod_state() == MOD_FSK) ? '1' : '0');
+            break;
+
+        case REMOTE_HOP_LIST:
+            for (uint8_t i = 0; i < mod_hop_count; i++)
+            {
+                if (i)
+                {
+                    uart_putc(',');
+                }
+                uart_put_uint(mod_hop_freqs[i]);
+            }
+            break;
+
+        case REMOTE_HOP_STAT:
+            uart_putc((mod_state() == MOD_HOP) ? '1' : '0');
+            break;
+    }
+}
+
+void _remote_set(uint8_t command, const char *param)
+{
+    /*
+    This function carries out a setting command. Settings that the front
+    panel locks out during a sweep are refused while one is running, or
+    while a stream is playing.
+    */
+
+    uint32_t value = 0;
+    int8_t choice = -1;
+
+    switch (command)
+    {
+        case REMOTE_RST:
+            if (mod_active())
+            {
+                stop_modulation();
+            }
+            if (is_sweep_started)
+            {
+                stop_sweep();
+                sched_post(TASK_OUTPUT);
+            }
+            frequency = DEFAULT_FREQ;
+            phase = DEFAULT_PHASE;
+            sweep_start_freq = SWEEP_START_DEFAULT;
+            sweep_stop_freq = SWEEP_STOP_DEFAULT;
+            sweep_time = SWEEP_TIME_DEFAULT;
+            mod_type = MOD_FM;
+            mod_shape = MOD_SHAPE_SINE;
+            mod_freq = MOD_FREQ_DEFAULT;
+            mod_deviation = MOD_DEVIATION_DEFAULT;
+            mod_depth = MOD_DEPTH_DEFAULT;
+            mod_psk_type = MOD_BPSK;
+            mod_key_source = MOD_KEY_PRBS;
+            mod_fsk_freq = MOD_FSK_FREQ_DEFAULT;
+            mod_hop_count = 0;
+            AD9833_set_waveform(FUNC_SINE);
+            func_select_state = FUNC_SINE;
+            set_frequency();
+            set_phase(phase);
+            update_display();
+            return;
+
+        case REMOTE_CLS:
+            _remote_error_count = 0;
+            remote_latency_max = 0;
+            return;
+
+        case REMOTE_FREQ:
+        case REMOTE_PHAS:
+        case REMOTE_SWE_STAR:
+        case REMOTE_SWE_STOP:
+        case REMOTE_SWE_TIME:
+        case REMOTE_STR_RATE:
+        case REMOTE_MOD_FREQ:
+        case REMOTE_MOD_DEV:
+        case REMOTE_MOD_DEPT:
+        case REMOTE_MOD_SRAT:
+        case REMOTE_PSK_BAUD:
+        case REMOTE_FSK_FREQ:
+        case REMOTE_FSK_BAUD:
+        case REMOTE_HOP_RATE:
+            if (!_remote_parse_number(param, &value, ((command == REMOTE_PHAS) || (command == REMOTE_MOD_DEPT)) ? REMOTE_UNIT_NONE :
+                                      (command == REMOTE_SWE_TIME) ? REMOTE_UNIT_MS : REMOTE_UNIT_HZ))
+            {
+                _remote_error(REMOTE_ERR_DATA_TYPE);
+                return;
+            }
+            break;
+
+        case REMOTE_FUNC:
+        case REMOTE_MOD_FUNC:
+            choice = _remote_lookup(PSTR("SINusoid\nTRIangle\nSQUare\n"), param, strlen(param));
+            break;
+
+        case REMOTE_MOD_TYPE:
+            choice = _remote_lookup(PSTR("FM\nPM\n"), param, strlen(param));
+            break;
+
+        case REMOTE_PSK_TYPE:
+            choice = _remote_lookup(PSTR("BPSK\nQPSK\n"), param, strlen(param));
+            break;
+
+        case REMOTE_PSK_SOUR:
+        case REMOTE_FSK_SOUR:
+            choice = _remote_lookup(PSTR("PRBS\nPATTern\n"), param, strlen(param));
+            break;
+
+        case REMOTE_PSK_DATA:
+        case REMOTE_FSK_DATA:
+            if (!_remote_parse_pattern(param))
+            {
+                _remote_error(REMOTE_ERR_DATA_TYPE);
+                return;
+            }
+            break;
+
+        case REMOTE_HOP_LIST:
+        case REMOTE_HOP_APP:
+            break;                                  // parsed when it is set
+
+        case REMOTE_SWE_SPAC:
+            choice = _remote_lookup(PSTR("LINear\nLOGarithmic\n"), param, strlen(param));
+            break;
+
+        case REMOTE_SWE_STAT:
+        case REMOTE_STR_STAT:
+        case REMOTE_MOD_STAT:
+        case REMOTE_PSK_STAT:
+        case REMOTE_FSK_STAT:
+        case REMOTE_HOP_STAT:
+            choice = _remote_lookup(PSTR("OFF\nON\n0\n1\n"), param, strlen(param));
+            break;
+
+        default:
+            _remote_error(REMOTE_ERR_HEADER);       // query only
+            return;
+    }
+
+    switch (command)
+    {
+        case REMOTE_FREQ:
+            if ((value < 1) || (value > MAX_FREQ))
+            {
+                _remote_error(REMOTE_ERR_RANGE);
+            }
+            else if (is_sweep_started || mod_active())
+            {
+                _remote_error(REMOTE_ERR_CONFLICT);
+            }
+            else
+            {
+                frequency = value;
+                set_frequency();
+                update_display();
+            }
+            break;
+
+        case REMOTE_PHAS:
+            if (value >= MAX_PHASE)
+            {
+                _remote_error(REMOTE_ERR_RANGE);
+            }
+            else if (is_sweep_started || mod_active())
+            {
+                _remote_error(REMOTE_ERR_CONFLICT);
+            }
+            else
+            {
+                phase = value;
+                set_phase(phase);
+                update_display();
+            }
+            break;
+
+        case REMOTE_FUNC:
+            if (choice < 0)
+            {
+                _remote_error(REMOTE_ERR_DATA_TYPE);
+            }
+            else if (is_sweep_started || mod_active() || ((choice != FUNC_SINE) && (frequency > MAX_TRI_SQ_FREQ)))
+            {
+                _remote_error(REMOTE_ERR_CONFLICT);
+            }
+            else
+            {
+                AD9833_set_waveform(choice);
+                func_select_state = choice;             // so set_frequency() limits for this waveform
+            }
+            break;
+
+        case REMOTE_SWE_STAR:
+        case REMOTE_SWE_STOP:
+            if ((value < 1) || (value > MAX_FREQ))
+            {
+                _remote_error(REMOTE_ERR_RANGE);
+                break;
+            }
+            if (command == REMOTE_SWE_STAR)
+            {
+                sweep_start_freq = value;
+            }
+            else
+            {
+                sweep_stop_freq = value;
+            }
+            _remote_sweep_changed(sweep_mode);
+            break;
+
+        case REMOTE_SWE_TIME:
+            if ((value < SWEEP_TIME_MIN) || (value > SWEEP_TIME_MAX))
+            {
+                _remote_error(REMOTE_ERR_RANGE);
+                break;
+            }
+            sweep_time = value;
+            _remote_sweep_changed(sweep_mode);
+            break;
+
+        case REMOTE_SWE_SPAC:
+            if (choice < 0)
+            {
+                _remote_error(REMOTE_ERR_DATA_TYPE);
+                break;
+            }
+            _remote_sweep_changed(choice ? FUNC_LOG_SWEEP : FUNC_LIN_SWEEP);
+            break;
+
+        case REMOTE_SWE_STAT:
+            if (choice < 0)
+            {
+                _remote_error(REMOTE_ERR_DATA_TYPE);
+            }
+            else if ((choice & 1) && mod_active())
+            {
+                _remote_error(REMOTE_ERR_CONFLICT);     // the stream is using FREQ1
+            }
+            else if (choice & 1)
+            {
+                start_sweep(sweep_mode);
+            }
+            else if (is_sweep_started)
+            {
+                stop_sweep();
+                if (func_select_state <= FUNC_SQUARE)
+                {
+                    AD9833_set_waveform(func_select_state);     // back to the front panel waveform
+                }
+                sched_post(TASK_OUTPUT);
+            }
+            break;
+
+        case REMOTE_STR_RATE:
+        case REMOTE_MOD_SRAT:
+        case REMOTE_PSK_BAUD:
+        case REMOTE_FSK_BAUD:
+        case REMOTE_HOP_RATE:
+            if ((value < MOD_RATE_MIN) || (value > MOD_RATE_MAX))
+            {
+                _remote_error(REMOTE_ERR_RANGE);
+            }
+            else if (_remote_streaming())
+            {
+                _remote_error(REMOTE_ERR_CONFLICT);     // can't change under a stream
+            }
+            else
+            {
+                mod_set_rate(value);
+                _remote_mod_changed();
+            }
+            break;
+
+        case REMOTE_STR_STAT:
+            if (choice < 0)
+            {
+                _remote_error(REMOTE_ERR_DATA_TYPE);
+            }
+            else if ((choice & 1) && (is_sweep_started || mod_active()))
+            {
+                _remote_error(REMOTE_ERR_CONFLICT);
+            }
+            else if (choice & 1)
+            {
+                start_stream();
+            }
+            else if (_remote_streaming())
+            {
+                stop_modulation();
+            }
+            break;
+
+        case REMOTE_MOD_TYPE:
+        case REMOTE_MOD_FUNC:
+            if (choice < 0)
+            {
+                _remote_error(REMOTE_ERR_DATA_TYPE);
+                break;
+            }
+            if (command == REMOTE_MOD_TYPE)
+            {
+                mod_type = choice;
+            }
+            else
+            {
+                mod_shape = choice;
+            }
+            _remote_mod_changed();
+            break;
+
+        case REMOTE_MOD_FREQ:
+        case REMOTE_MOD_DEV:
+        case REMOTE_MOD_DEPT:
+            if ((command == REMOTE_MOD_FREQ) && ((value < 1) || (value > (MOD_RATE_MAX / 2))))
+            {
+                _remote_error(REMOTE_ERR_RANGE);
+                break;
+            }
+            if ((command == REMOTE_MOD_DEV) && ((value < 1) || (value > MAX_FREQ)))
+            {
+                _remote_error(REMOTE_ERR_RANGE);
+                break;
+            }
+            if ((command == REMOTE_MOD_DEPT) && (value > MOD_DEPTH_MAX))
+            {
+                _remote_error(REMOTE_ERR_RANGE);
+                break;
+            }
+            if (command == REMOTE_MOD_FREQ)
+            {
+                mod_freq = value;
+            }
+            else if (command == REMOTE_MOD_DEV)
+            {
+                mod_deviation = value;
+            }
+            else
+            {
+                mod_depth = value;
+            }
+            _remote_mod_changed();
+            break;
+
+        case REMOTE_MOD_STAT:
+            _remote_engine_state(MOD_WAVE, choice);
+            break;
+
+        case REMOTE_PSK_TYPE:
+        case REMOTE_PSK_SOUR:
+        case REMOTE_FSK_SOUR:
+            if (choice < 0)
+            {
+                _remote_error(REMOTE_ERR_DATA_TYPE);
+                break;
+            }
+            if (command == REMOTE_PSK_TYPE)
+            {
+                mod_psk_type = choice;
+            }
+            else
+            {
+                mod_key_source = choice;
+            }
+            _remote_mod_changed();
+            break;
+
+        case REMOTE_PSK_DATA:
+        case REMOTE_FSK_DATA:
+            _remote_mod_changed();
+            break;
+
+        case REMOTE_PSK_STAT:
+            _remote_engine_state(MOD_PSK, choice);
+            break;
+
+        case REMOTE_FSK_FREQ:
+            if ((value < 1) || (value > MAX_FREQ))
+            {
+                _remote_error(REMOTE_ERR_RANGE);
+                break;
+            }
+            mod_fsk_freq = value;
+            _remote_mod_changed();
+            break;
+
+        case REMOTE_FSK_STAT:
+            _remote_engine_state(MOD_FSK, choice);
+            break;
+
+        case REMOTE_HOP_LIST:
+        case REMOTE_HOP_APP:
+            if (_remote_parse_hops(param, (command == REMOTE_HOP_APP)))
+            {
+                _remote_mod_changed();
+            }
+            break;
+
+        case REMOTE_HOP_STAT:
+            _remote_engine_state(MOD_HOP, choice);
+            break;
+    }
+}
+
+void _remote_command(char *cmd)
+{
+    /*
+    This function splits one command into its header and parameter and
+    carries it out.
+    */
+
+    char *header;
+    char *end;
+    uint8_t len;
+    uint8_t query = 0;
+    int8_t command;
+
+    while (*cmd == ' ')
+    {
+        cmd++;
+    }
+    if (*cmd == ':')
+    {
+        cmd++;
+    }
+    if (*cmd == 0)
+    {
+        return;
+    }
+
+    header = cmd;
+    while (*cmd && (*cmd != ' '))
+    {
+        cmd++;
+    }
+    len = cmd - header;
+    if (header[len - 1] == '?')
+    {
+        query = 1;
+        len -= 1;
+    }
+
+    // the parameter, without surrounding spaces
+    while (*cmd == ' ')
+    {
+        cmd++;
+    }
+    end = cmd + strlen(cmd);
+    while ((end > cmd) && (end[-1] == ' '))
+    {
+        *--end = 0;
+    }
+
+    // optional SOURce: root for the generator settings
+    for (uint8_t i = 0; i < len; i++)
+    {
+        if (header[i] == ':')
+        {
+            if (_remote_match(PSTR("SOURce\n"), header, i))
+            {
+                header += i + 1;
+                len -= i + 1;
+            }
+            break;
+        }
+    }
+
+    command = _remote_lookup(_remote_headers, header, len);
+    if (command < 0)
+    {
+        _remote_error(REMOTE_ERR_HEADER);
+    }
+    else if (query)
+    {
+        if ((command == REMOTE_RST) || (command == REMOTE_CLS) || (command == REMOTE_HOP_APP))
+        {
+            _remote_error(REMOTE_ERR_HEADER);
+        }
+        else if (*cmd)
+        {
+            _remote_error(REMOTE_ERR_PARAM);
+        }
+        else
+        {
+            _remote_query(command);
+        }
+    }
+    else if ((command <= REMOTE_OPC) && *cmd)
+    {
+        _remote_error(REMOTE_ERR_PARAM);
+    }
+    else if ((command > REMOTE_OPC) && (*cmd == 0))
+    {
+        _remote_error(REMOTE_ERR_MISSING);
+    }
+    else
+    {
+        _remote_set(command, cmd);
+    }
+}
+
+void _remote_execute(char *line)
+{
+    /*
+    This function carries out each command in a line, and ends the reply if
+    there was one.
+    */
+
+    char *next;
+
+    for (char *c = line; *c; c++)
+    {
+        if ((*c >= 'a') && (*c <= 'z'))
+        {
+            *c -= 'a' - 'A';
+        }
+        else if (*c == '\t')
+        {
+            *c = ' ';
+        }
+    }
+
+    _remote_replies = 0;
+    while (line)
+    {
+        next = strchr(line, ';');
+        if (next)
+        {
+            *next++ = 0;
+        }
+        _remote_command(line);
+        line = next;
+    }
+
+    if (_remote_replies)
+    {
+        uart_putc('\n');
+    }
+}
+
+uint8_t remote_poll(void)
+{
+    /*
+    This function takes received bytes until a line is complete, then carries
+    it out. Returns true if a line was carried out, there may be more.
+    */
+
+    uint8_t data;
+    uint32_t stamp = 0;
+    uint16_t rx_errors = 0;
+
+    while (uart_getc(&data))
+    {
+        if ((data != '\r') && (data != '\n'))
+        {
+            _remote_in_line = 1;
+            if (_remote_len < (REMOTE_LINE_MAX - 1))
+            {
+                _remote_line[_remote_len++] = data;
+            }
+            else
+            {
+                _remote_overrun = 1;
+            }
+            continue;
+        }
+        if (!_remote_in_line)
+        {
+            continue;                       // LF after CR, or a blank line
+        }
+
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+        {
+            rx_errors = uart_rx_errors;
+        }
+        if (rx_errors != _remote_rx_errors)
+        {
+            _remote_rx_errors = rx_errors;  // bytes were lost on the way in
+            _remote_overrun = 1;
+        }
+
+        _remote_line[_remote_len] = 0;
+        if (_remote_overrun)
+        {
+            _remote_error(REMOTE_ERR_OVERRUN);
+        }
+        else
+        {
+            _remote_execute(_remote_line);
+        }
+        _remote_len = 0;
+        _remote_in_line = 0;
+        _remote_overrun = 0;
+
+        if (uart_line_stamp(&stamp))
+        {
+            remote_latency_last = event_us_since(stamp);
+            if (remote_latency_last > remote_latency_max)
+            {
+                remote_latency_max = remote_latency_last;
+            }
+        }
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,127 @@
+/* 
+ * This file is part of the BASE-4 distribution (website).
+ * Copyright (c) 2018 Tim Buchanan.
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef LIBREMOTE_H
+#define LIBREMOTE_H
+
+// SCPI style remote control over the UART. Bytes are taken as they arrive and
+// built up into a fixed line buffer, and each line is carried out when it
+// ends. Commands are separated by ';' and each one is a full header, e.g.
+//
+//     FREQ 1.5KHZ;PHAS 1024;FUNC TRI
+//     SWE:STAR 1000;SWE:STOP 100KHZ;SWE:TIME 500MS;SWE:SPAC LOG;SWE:STAT ON
+//     FREQ?;SYST:ERR?
+//
+// Headers can be given in short (upper case part) or long form, in any case,
+// and FREQ/PHAS/FUNC can have a SOURce: prefix. Query replies in a line are
+// joined with ';' and sent together. Errors go on a small queue read with
+// SYST:ERR?. SYST:LAT? gives the time from the end of the last command line
+// to it being carried out, and the longest seen, in microseconds.
+//
+// STR:STAT ON hands the UART over to binary sample frames (see
+// libmodulation.h) until an end word. Send it as STR:STAT ON;*OPC? and wait
+// for the reply before the first frame. STR:COUN? gives underruns, bad
+// frames, dropped frames and late samples from the last stream.
+//
+// MOD:TYPE FM|PM, MOD:FUNC, MOD:FREQ, MOD:DEV (FM, Hz) and MOD:DEPT (PM,
+// 2pi/4096) set up wavetable modulation of the carrier set by FREQ/PHAS, and
+// MOD:STAT ON starts it. MOD:SRAT is the sample rate, the same setting as
+// STR:RATE.
+//
+// PSK:TYPE BPSK|QPSK, PSK:SOUR PRBS|PATT and PSK:DATA set up phase shift
+// keying of the carrier, PSK:STAT ON starts it. The pattern is given in hex
+// (#HF9A8, or just F9A8) or binary (#B1111100110101) and sent MSB first.
+// PSK:BAUD is the symbol rate, again the same setting as STR:RATE.
+//
+// FSK:FREQ is the tone for a 1, the carrier (FREQ) is used for a 0.
+// FSK:SOUR and FSK:DATA are the same settings as PSK:SOUR and PSK:DATA.
+// HOP:LIST 1KHZ,2KHZ,.. sets the hop channels (up to 16, HOP:APP adds more
+// when they don't fit on one line), HOP:RATE is hops per second.
+//
+// SWE:TIME is 1MS to 86400S. SWE:ACT? gives what the sweep really runs at:
+// the number of steps, the mean step period in us and the sweep time in ms.
+
+#define REMOTE_LINE_MAX         80          // longest line, longer ones are dropped with an error
+#define REMOTE_ERRORS           4           // error queue length
+#define REMOTE_IDN              "BASE-4,BASE-4,0,1.0"
+
+// commands, in the order of _remote_headers
+#define REMOTE_IDN_Q            0
+#define REMOTE_RST              1
+#define REMOTE_CLS              2
+#define REMOTE_OPC              3
+#define REMOTE_FREQ             4
+#define REMOTE_PHAS             5
+#define REMOTE_FUNC             6
+#define REMOTE_SWE_STAR         7
+#define REMOTE_SWE_STOP         8
+#define REMOTE_SWE_TIME         9
+#define REMOTE_SWE_SPAC         10
+#define REMOTE_SWE_STAT         11
+#define REMOTE_SYST_ERR         12
+#define REMOTE_SYST_LAT         13
+#define REMOTE_STR_RATE         14
+#define REMOTE_STR_STAT         15
+#define REMOTE_STR_COUN         16
+#define REMOTE_MOD_TYPE         17
+#define REMOTE_MOD_FUNC         18
+#define REMOTE_MOD_FREQ         19
+#define REMOTE_MOD_DEV          20
+#define REMOTE_MOD_DEPT         21
+#define REMOTE_MOD_SRAT         22
+#define REMOTE_MOD_STAT         23
+#define REMOTE_PSK_TYPE         24
+#define REMOTE_PSK_SOUR         25
+#define REMOTE_PSK_DATA         26
+#define REMOTE_PSK_BAUD         27
+#define REMOTE_PSK_STAT         28
+#define REMOTE_FSK_FREQ         29
+#define REMOTE_FSK_SOUR         30
+#define REMOTE_FSK_DATA         31
+#define REMOTE_FSK_BAUD         32
+#define REMOTE_FSK_STAT         33
+#define REMOTE_HOP_LIST         34
+#define REMOTE_HOP_APP          35
+#define REMOTE_HOP_RATE         36
+#define REMOTE_HOP_STAT         37
+#define REMOTE_SWE_ACT          38
+
+// SCPI error numbers
+#define REMOTE_ERR_NONE         0
+#define REMOTE_ERR_DATA_TYPE    -104
+#define REMOTE_ERR_PARAM        -108        // parameter not allowed
+#define REMOTE_ERR_MISSING      -109        // missing parameter
+#define REMOTE_ERR_HEADER       -113        // undefined header
+#define REMOTE_ERR_CONFLICT     -221        // settings conflict
+#define REMOTE_ERR_RANGE        -222        // data out of range
+#define REMOTE_ERR_OVERFLOW     -350        // error queue overflow
+#define REMOTE_ERR_OVERRUN      -363        // input buffer overrun
+
+// units for _remote_parse_number()
+#define REMOTE_UNIT_NONE        0
+#define REMOTE_UNIT_HZ          1
+#define REMOTE_UNIT_MS          2
+
+extern uint32_t remote_latency_last;
+extern uint32_t remote_latency_max;
+
+// prototypes
+
+void remote_init(void);
+uint8_t remote_poll(void);
+
+#endif /* LIBREMOTE_H */
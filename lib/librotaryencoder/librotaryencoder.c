@@ -15,11 +15,32 @@
  * along with this program. If not, see <http://www.gnu.org/licenses/>.
 */
 
-#include <avr/io.h>
-#include <avr/interrupt.h>
+#include "hal.h"
 #include "librotaryencoder.h"
+#include "libevent.h"
 #include "globals.h"
 
+// quarter steps for each (previous state << 2 | state). Clockwise runs 3, 1, 0, 2.
+// No change, or both channels changing at once, counts 0.
+const int8_t _rot_enc_table[16] PROGMEM =
+{
+     0, -1,  1,  0,
+     1,  0,  0, -1,
+    -1,  0,  0,  1,
+     0,  1, -1,  0
+};
+
+uint8_t _rot_enc_state;                     // channel state at the last edge
+int8_t _rot_enc_quarters = 0;               // quarter steps since the last detent
+uint8_t rot_enc_speed = 0;
+
+uint8_t _rot_enc_read_state(void)
+{
+    uint8_t pins = hal_encoder_pins();
+
+    return (((pins >> ROT_ENC_D0) & 1) << 1) | ((pins >> ROT_ENC_D1) & 1);
+}
+
 void rotary_encoder_init(void)
 {
     /*
@@ -27,10 +48,66 @@ void rotary_encoder_init(void)
     as well as interrupts.
     */
 
-    ROT_ENC_DDR &= ~(1 << ROT_ENC_D0) | (1 << ROT_ENC_D1);
-    
-    cli();
-    EIMSK = (1 << INT1) | (1 << INT0);          // enable INT0 and INT1
-    EICRA = (1 << ISC11) | (1 << ISC01);        // interrupt on falling edge
-    sei();
+    _rot_enc_state = _rot_enc_read_state();
+    hal_encoder_init();
+}
+
+int32_t rotary_encoder_accelerate(int16_t detents)
+{
+    /*
+    This function scales the detents read each tick by how fast the knob is
+    being turned, so spinning it covers decades quickly. Every detent is still
+    counted.
+    */
+
+    uint8_t turned = (detents < 0) ? -detents : detents;
+
+    // decays by a quarter each tick
+    if (turned > (0xFF - rot_enc_speed))
+    {
+        rot_enc_speed = 0xFF;
+    }
+    else
+    {
+        rot_enc_speed += turned;
+    }
+    rot_enc_speed -= rot_enc_speed >> 2;
+
+    if (rot_enc_speed >= ROT_ENC_ACCEL_FAST)
+    {
+        return (int32_t)detents * ROT_ENC_ACCEL_FAST_MUL;
+    }
+    if (rot_enc_speed >= ROT_ENC_ACCEL_MED)
+    {
+        return (int32_t)detents * ROT_ENC_ACCEL_MED_MUL;
+    }
+    return detents;
+}
+
+ISR(PCINT2_vect)
+{
+    /*
+    Rotary encoder pin change interrupt, on either channel. Quarter steps are
+    added up from the transition table and a detent event is queued each time
+    the encoder comes back to rest, so a missed or bounced edge can't leave it
+    out of step.
+    */
+
+    uint8_t state = _rot_enc_read_state();
+
+    _rot_enc_quarters += (int8_t)pgm_read_byte(&_rot_enc_table[(_rot_enc_state << 2) | state]);
+    _rot_enc_state = state;
+
+    if (state == ROT_ENC_REST_STATE)
+    {
+        if (_rot_enc_quarters >= 2)
+        {
+            event_put(EVENT_ENCODER, 1);
+        }
+        else if (_rot_enc_quarters <= -2)
+        {
+            event_put(EVENT_ENCODER, -1);
+        }
+        _rot_enc_quarters = 0;
+    }
 }
\ No newline at end of file
@@ -15,6 +15,17 @@
  * along with this program. If not, see <http://www.gnu.org/licenses/>.
 */
 
+// quadrature decoding. The two channels are read as a 2 bit state (D0 << 1 | D1),
+// both high is the rest (detent) position.
+#define ROT_ENC_REST_STATE      3
+
+// acceleration. rot_enc_speed is roughly the detents turned in the last 4 ticks
+#define ROT_ENC_ACCEL_MED       4           // about 33 detents a second
+#define ROT_ENC_ACCEL_FAST      10          // about 83 detents a second
+#define ROT_ENC_ACCEL_MED_MUL   10
+#define ROT_ENC_ACCEL_FAST_MUL  100
+
 // prototypes
 
-void rotary_encoder_init(void);
\ No newline at end of file
+void rotary_encoder_init(void);
+int32_t rotary_encoder_accelerate(int16_t detents);
\ No newline at end of file
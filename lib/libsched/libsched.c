@@ -0,0 +1,151 @@
+/* 
+ * This file is part of the BASE-4 distribution (website).
+ * Copyright (c) 2018 Tim Buchanan.
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "hal.h"
+#include "libsched.h"
+
+sched_task_t _sched_tasks[SCHED_MAX_TASKS];
+uint16_t _sched_overruns = 0;               // periodic runs that came due while the last was still waiting
+
+void sched_add(uint8_t task, sched_fn_t fn, uint16_t period)
+{
+    /*
+    This function puts a task in a slot. If period is not 0 the task runs
+    every period ticks, otherwise it only runs when posted.
+    */
+
+    if (task >= SCHED_MAX_TASKS)
+    {
+        return;
+    }
+
+    _sched_tasks[task].fn = fn;
+    _sched_tasks[task].period = period;
+    _sched_tasks[task].countdown = period;
+    _sched_tasks[task].ready = 0;
+}
+
+void sched_post(uint8_t task)
+{
+    /*
+    This function makes a task ready to run as soon as nothing more urgent
+    is waiting.
+    */
+
+    if (task < SCHED_MAX_TASKS)
+    {
+        _sched_tasks[task].ready = 1;
+    }
+}
+
+void sched_after(uint8_t task, uint16_t ticks)
+{
+    /*
+    This function runs a task once, ticks from now. A periodic task carries on
+    at its period from then. Calling it again before it runs moves the time.
+    */
+
+    if (task >= SCHED_MAX_TASKS)
+    {
+        return;
+    }
+
+    if (ticks == 0)
+    {
+        _sched_tasks[task].ready = 1;
+    }
+    else
+    {
+        _sched_tasks[task].countdown = ticks;
+    }
+}
+
+void sched_cancel(uint8_t task)
+{
+    /*
+    This function stops a task, and its timer, until it is posted or given a
+    new time with sched_after().
+    */
+
+    if (task < SCHED_MAX_TASKS)
+    {
+        _sched_tasks[task].ready = 0;
+        _sched_tasks[task].countdown = 0;
+    }
+}
+
+void sched_tick(void)
+{
+    /*
+    This function counts down the timed tasks, call it once per system tick.
+    */
+
+    for (uint8_t i = 0; i < SCHED_MAX_TASKS; i++)
+    {
+        sched_task_t *t = &_sched_tasks[i];
+
+        if (t->countdown == 0)
+        {
+            continue;
+        }
+
+        t->countdown -= 1;
+        if (t->countdown == 0)
+        {
+            if (t->ready)
+            {
+                _sched_overruns += 1;
+            }
+            t->ready = 1;
+            t->countdown = t->period;
+        }
+    }
+}
+
+uint8_t sched_run(void)
+{
+    /*
+    This function runs ready tasks, most urgent first, until none are left.
+    Returns how many ran.
+    */
+
+    uint8_t ran = 0;
+    uint8_t i = 0;
+
+    while (i < SCHED_MAX_TASKS)
+    {
+        sched_task_t *t = &_sched_tasks[i];
+
+        if (t->ready && t->fn)
+        {
+            t->ready = 0;
+            t->fn();
+            ran += 1;
+            i = 0;                          // something more urgent may have been posted
+        }
+        else
+        {
+            i++;
+        }
+    }
+    return ran;
+}
+
+uint16_t sched_overruns(void)
+{
+    return _sched_overruns;
+}
@@ -0,0 +1,49 @@
+/* 
+ * This file is part of the BASE-4 distribution (website).
+ * Copyright (c) 2018 Tim Buchanan.
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef LIBSCHED_H
+#define LIBSCHED_H
+
+// Cooperative scheduler for the main loop. Each task has a fixed slot, and
+// the slot number is its priority, 0 being the most urgent. Tasks run to
+// completion and the scan starts again from slot 0 after each one, so a
+// ready task never waits longer than the longest single lower priority task.
+// Only call these from the main loop.
+
+#define SCHED_MAX_TASKS         8
+
+typedef void (*sched_fn_t)(void);
+
+typedef struct
+{
+    sched_fn_t fn;
+    uint16_t period;                        // ticks between runs, 0 if not periodic
+    uint16_t countdown;                     // ticks until the next timed run, 0 if none
+    uint8_t ready;
+} sched_task_t;
+
+// prototypes
+
+void sched_add(uint8_t task, sched_fn_t fn, uint16_t period);
+void sched_post(uint8_t task);
+void sched_after(uint8_t task, uint16_t ticks);
+void sched_cancel(uint8_t task);
+void sched_tick(void);
+uint8_t sched_run(void);
+uint16_t sched_overruns(void);
+
+#endif /* LIBSCHED_H */
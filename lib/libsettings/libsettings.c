@@ -0,0 +1,220 @@
+/* 
+ * This file is part of the BASE-4 distribution (website).
+ * Copyright (c) 2018 Tim Buchanan.
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stddef.h>
+#include <string.h>
+#include "hal.h"
+#include "libsettings.h"
+#include "libbase4.h"
+#include "globals.h"
+
+settings_record_t _settings_seen;           // settings at the last look
+settings_record_t _settings_saved;          // settings in the newest record
+settings_record_t _settings_record;         // the record being written
+uint8_t _settings_quiet = 0;                // looks since the settings last changed
+uint8_t _settings_slot = SETTINGS_SLOTS - 1;    // slot of the newest record
+uint16_t _settings_seq = 0;
+uint16_t _settings_address;                 // EEPROM address of the slot being written
+volatile uint8_t _settings_pos;             // next byte of _settings_record to write
+volatile uint8_t _settings_writing = 0;
+uint16_t settings_saves = 0;
+
+uint16_t _settings_crc(const settings_record_t *record)
+{
+    /*
+    This function returns the CRC-16/CCITT (0x1021, starting at 0xFFFF) of a
+    record, up to its crc field.
+    */
+
+    const uint8_t *data = (const uint8_t *)record;
+    uint16_t crc = 0xFFFF;
+
+    for (uint8_t i = 0; i < offsetof(settings_record_t, crc); i++)
+    {
+        crc ^= (uint16_t)data[i] << 8;
+        for (uint8_t bit = 0; bit < 8; bit++)
+        {
+            crc = (crc & 0x8000) ? ((crc << 1) ^ 0x1021) : (crc << 1);
+        }
+    }
+    return crc;
+}
+
+void _settings_capture(settings_record_t *record)
+{
+    /*
+    This function fills a record from the live settings. The sequence number
+    and CRC are left at 0 so two captures can be compared whole.
+    */
+
+    memset(record, 0, sizeof(*record));
+    record->version = SETTINGS_VERSION;
+    record->selected_digit = selected_digit;
+    record->frequency = frequency;
+    record->sweep_start_freq = sweep_start_freq;
+    record->sweep_stop_freq = sweep_stop_freq;
+    record->sweep_time = sweep_time;
+    record->phase = phase;
+    record->psk_type = mod_psk_type;
+    record->key_source = mod_key_source;
+    record->key_bits = mod_key_bits;
+    memcpy(record->key_pattern, mod_key_pattern, sizeof(record->key_pattern));
+}
+
+uint8_t _settings_valid(const settings_record_t *record)
+{
+    /*
+    This function checks a record read from EEPROM. Returns false if it is
+    from another version, is damaged or holds a setting out of range.
+    */
+
+    if ((record->version != SETTINGS_VERSION) || (record->crc != _settings_crc(record)))
+    {
+        return 0;
+    }
+
+    return (record->frequency >= 1) && (record->frequency <= MAX_FREQ) &&
+           (record->sweep_start_freq >= 1) && (record->sweep_start_freq <= MAX_FREQ) &&
+           (record->sweep_stop_freq >= 1) && (record->sweep_stop_freq <= MAX_FREQ) &&
+           (record->sweep_time >= SWEEP_TIME_MIN) && (record->sweep_time <= SWEEP_TIME_MAX) &&
+           (record->phase <= MAX_PHASE) &&
+           (record->psk_type <= MOD_QPSK) && (record->key_source <= MOD_KEY_PATTERN) &&
+           (record->key_bits >= 1) && (record->key_bits <= (MOD_KEY_PATTERN_MAX * 8)) &&
+           (record->selected_digit >= 1) && (record->selected_digit <= DIGITS_SWEEP_TIME);
+}
+
+uint8_t settings_load(void)
+{
+    /*
+    This function restores the newest good record, reading each slot once.
+    Only the variables are set, call it before initial_setup() which sends
+    them to the AD9833 and display. Returns false if there was none, the
+    defaults are kept then.
+    */
+
+    settings_record_t record;
+    uint8_t found = 0;
+
+    for (uint8_t slot = 0; slot < SETTINGS_SLOTS; slot++)
+    {
+        uint8_t *data = (uint8_t *)&record;
+        uint16_t address = slot * sizeof(record);
+
+        for (uint8_t i = 0; i < sizeof(record); i++)
+        {
+            data[i] = hal_eeprom_read(address + i);
+        }
+
+        // sequence numbers wrap, but every record in the ring is within
+        // SETTINGS_SLOTS saves of the newest
+        if (_settings_valid(&record) && (!found || ((int16_t)(record.seq - _settings_seq) > 0)))
+        {
+            found = 1;
+            _settings_slot = slot;
+            _settings_seq = record.seq;
+            _settings_saved = record;
+        }
+    }
+
+    if (found)
+    {
+        frequency = _settings_saved.frequency;
+        phase = _settings_saved.phase;
+        sweep_start_freq = _settings_saved.sweep_start_freq;
+        sweep_stop_freq = _settings_saved.sweep_stop_freq;
+        sweep_time = _settings_saved.sweep_time;
+        selected_digit = _settings_saved.selected_digit;
+        mod_psk_type = _settings_saved.psk_type;
+        mod_key_source = _settings_saved.key_source;
+        mod_key_bits = _settings_saved.key_bits;
+        memcpy(mod_key_pattern, _settings_saved.key_pattern, sizeof(mod_key_pattern));
+    }
+
+    // what is running now is what is saved, nothing to write until it changes
+    _settings_capture(&_settings_saved);
+    _settings_seen = _settings_saved;
+    return found;
+}
+
+void settings_poll(void)
+{
+    /*
+    This function is the settings task. It starts writing a new record once
+    the settings have changed and then stayed the same for a while.
+    */
+
+    settings_record_t now;
+
+    if (_settings_writing)
+    {
+        return;                             // look again once it is done
+    }
+
+    _settings_capture(&now);
+    if (memcmp(&now, &_settings_seen, sizeof(now)) != 0)
+    {
+        _settings_seen = now;
+        _settings_quiet = 0;
+        return;
+    }
+    if (_settings_quiet < SETTINGS_IDLE_POLLS)
+    {
+        _settings_quiet += 1;
+        return;
+    }
+    if (memcmp(&now, &_settings_saved, sizeof(now)) == 0)
+    {
+        return;
+    }
+
+    _settings_saved = now;
+    _settings_record = now;
+    _settings_record.seq = ++_settings_seq;
+    _settings_record.crc = _settings_crc(&_settings_record);
+
+    _settings_slot = (_settings_slot + 1) % SETTINGS_SLOTS;
+    _settings_address = _settings_slot * sizeof(_settings_record);
+    _settings_pos = 0;
+    _settings_writing = 1;
+    hal_eeprom_irq(1);
+}
+
+ISR(EE_READY_vect)
+{
+    /*
+    This handler writes the next byte of the record that differs from what
+    the EEPROM already holds. It runs again when that write is done.
+    */
+
+    const uint8_t *data = (const uint8_t *)&_settings_record;
+
+    while (_settings_pos < sizeof(_settings_record))
+    {
+        uint16_t address = _settings_address + _settings_pos;
+        uint8_t byte = data[_settings_pos++];
+
+        if (hal_eeprom_read(address) != byte)
+        {
+            hal_eeprom_write(address, byte);
+            return;
+        }
+    }
+
+    hal_eeprom_irq(0);
+    _settings_writing = 0;
+    settings_saves += 1;
+}
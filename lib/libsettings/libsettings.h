@@ -0,0 +1,69 @@
+/* 
+ * This file is part of the BASE-4 distribution (website).
+ * Copyright (c) 2018 Tim Buchanan.
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef LIBSETTINGS_H
+#define LIBSETTINGS_H
+
+#include "libmodulation.h"
+
+// Front panel settings kept in EEPROM over a power cycle. Each save is a
+// whole record written into the next slot of a ring that covers the EEPROM,
+// so the wear is spread over every cell. A record carries a version, a
+// sequence number and a CRC, with the CRC written last so a record cut short
+// by a power failure is ignored. At startup every slot is read once and the
+// newest good record is restored, before anything is sent to the AD9833.
+// The PSK and FSK keying settings are kept too, so a bit pattern loaded with
+// PSK:DATA is still there for PSK:SOUR PATT after a power cycle.
+//
+// Saves are coalesced. The settings task compares the live settings with
+// what it saw last time, and only saves once they have stayed the same for
+// SETTINGS_IDLE_POLLS looks, so a run of knob turns is one save at the end.
+// The record goes out a byte at a time from the EEPROM ready interrupt, so
+// the 3.4 ms per byte is spent in the background, and bytes that already
+// hold the right value are not written at all.
+
+#define SETTINGS_VERSION        3           // change when settings_record_t changes
+#define SETTINGS_POLL_TICKS     17          // about 0.5 s
+#define SETTINGS_IDLE_POLLS     4           // unchanged for about 2 s before saving
+#define SETTINGS_SLOTS          (HAL_EEPROM_SIZE / sizeof(settings_record_t))
+
+// laid out without padding on the AVR and the host, crc must be last
+typedef struct
+{
+    uint8_t version;
+    uint8_t selected_digit;
+    uint16_t seq;                           // one more for each save, wraps
+    uint32_t frequency;
+    uint32_t sweep_start_freq;
+    uint32_t sweep_stop_freq;
+    uint32_t sweep_time;                    // ms
+    uint16_t phase;
+    uint8_t psk_type;
+    uint8_t key_source;
+    uint16_t key_bits;
+    uint8_t key_pattern[MOD_KEY_PATTERN_MAX];
+    uint16_t crc;                           // CRC-16/CCITT of everything before it
+} settings_record_t;
+
+extern uint16_t settings_saves;             // records written since power up
+
+// prototypes
+
+uint8_t settings_load(void);
+void settings_poll(void);
+
+#endif /* LIBSETTINGS_H */
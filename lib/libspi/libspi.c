@@ -0,0 +1,239 @@
+/* 
+ * This file is part of the BASE-4 distribution (website).
+ * Copyright (c) 2018 Tim Buchanan.
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "hal.h"
+#include "libspi.h"
+#include "globals.h"
+
+// NOTE: all chip selects are assumed to be on SPI_PORT
+
+typedef struct
+{
+    uint8_t cs;                             // chip select bit mask
+    uint8_t mode;                           // SPCR clock mode bits
+    uint8_t len;
+    uint8_t data[SPI_FRAME_MAX];
+} spi_frame_t;
+
+spi_frame_t _spi_queue_hi[SPI_QUEUE_HI_LEN];
+spi_frame_t _spi_queue_lo[SPI_QUEUE_LO_LEN];
+volatile uint8_t _spi_hi_head = 0;
+volatile uint8_t _spi_hi_tail = 0;
+volatile uint8_t _spi_lo_head = 0;
+volatile uint8_t _spi_lo_tail = 0;
+spi_frame_t * volatile _spi_active = 0;     // frame currently on the bus, 0 if idle
+volatile uint8_t _spi_pos;                  // byte of the active frame being sent
+
+void spi_init(void)
+{
+    /*
+    This function initialises the SPI bus.
+    */
+
+    hal_spi_init();
+}
+
+void _spi_start_next(void)
+{
+    /*
+    This function puts the next queued frame on the bus, high priority first.
+    Must be called with interrupts disabled.
+    */
+
+    spi_frame_t *frame;
+
+    if (_spi_hi_head != _spi_hi_tail)
+    {
+        frame = &_spi_queue_hi[_spi_hi_tail];
+    }
+    else if (_spi_lo_head != _spi_lo_tail)
+    {
+        frame = &_spi_queue_lo[_spi_lo_tail];
+    }
+    else
+    {
+        _spi_active = 0;
+        return;
+    }
+
+    _spi_active = frame;
+    _spi_pos = 0;
+    hal_spi_set_mode(frame->mode);
+    hal_cs_assert(frame->cs);
+    hal_spi_write(frame->data[0]);
+}
+
+void _spi_service(void)
+{
+    /*
+    This function is called each time a byte has finished sending. It sends
+    the next byte of the active frame, or ends the frame and starts the next.
+    Must be called with interrupts disabled.
+    */
+
+    spi_frame_t *frame = _spi_active;
+
+    if (frame == 0)
+    {
+        return;
+    }
+
+    _spi_pos += 1;
+    if (_spi_pos < frame->len)
+    {
+        hal_spi_write(frame->data[_spi_pos]);
+        return;
+    }
+
+    hal_cs_release(frame->cs);
+
+    // frame done, free its slot
+    if (frame == &_spi_queue_hi[_spi_hi_tail])
+    {
+        _spi_hi_tail = (_spi_hi_tail + 1) & (SPI_QUEUE_HI_LEN - 1);
+        if (_spi_hi_tail == _spi_hi_head)
+        {
+            HAL_BENCH_END(mod_sample);      // all AD9833 words are out
+        }
+    }
+    else
+    {
+        _spi_lo_tail = (_spi_lo_tail + 1) & (SPI_QUEUE_LO_LEN - 1);
+    }
+
+    _spi_start_next();
+}
+
+void spi_enqueue(uint8_t prio, uint8_t cs, uint8_t mode, const uint8_t *data, uint8_t len)
+{
+    /*
+    This function queues a frame of up to SPI_FRAME_MAX bytes to be sent under
+    one chip select assertion. It only blocks if the queue is full. Safe to call
+    from interrupt context.
+    */
+
+    spi_frame_t *frame;
+    uint8_t next;
+
+    if ((len == 0) || (len > SPI_FRAME_MAX))
+    {
+        return;
+    }
+
+    while (1)
+    {
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+        {
+            if (prio == SPI_PRIO_HIGH)
+            {
+                next = (_spi_hi_head + 1) & (SPI_QUEUE_HI_LEN - 1);
+                frame = (next != _spi_hi_tail) ? &_spi_queue_hi[_spi_hi_head] : 0;
+            }
+            else
+            {
+                next = (_spi_lo_head + 1) & (SPI_QUEUE_LO_LEN - 1);
+                frame = (next != _spi_lo_tail) ? &_spi_queue_lo[_spi_lo_head] : 0;
+            }
+
+            if (frame)
+            {
+                frame->cs = cs;
+                frame->mode = mode;
+                frame->len = len;
+                for (uint8_t i = 0; i < len; i++)
+                {
+                    frame->data[i] = data[i];
+                }
+
+                if (prio == SPI_PRIO_HIGH)
+                {
+                    _spi_hi_head = next;
+                }
+                else
+                {
+                    _spi_lo_head = next;
+                }
+
+                if (_spi_active == 0)
+                {
+                    _spi_start_next();
+                }
+                return;
+            }
+
+            // queue full. If we were called with interrupts off the STC interrupt
+            // can't drain it, so poll the bus here instead
+            if (!hal_irq_enabled() && hal_spi_done())
+            {
+                _spi_service();
+            }
+        }
+        hal_idle();
+    }
+}
+
+uint8_t spi_busy(void)
+{
+    /*
+    This function returns true if a frame is on the bus or waiting in the queue.
+    */
+
+    return (_spi_active != 0);
+}
+
+uint8_t spi_queued(uint8_t prio)
+{
+    /*
+    This function returns how many frames of the given priority are waiting or
+    on the bus.
+    */
+
+    if (prio == SPI_PRIO_HIGH)
+    {
+        return (_spi_hi_head - _spi_hi_tail) & (SPI_QUEUE_HI_LEN - 1);
+    }
+    return (_spi_lo_head - _spi_lo_tail) & (SPI_QUEUE_LO_LEN - 1);
+}
+
+void spi_flush(void)
+{
+    /*
+    This function waits until every queued frame has been sent. It also works
+    with interrupts off, as at startup, by polling the bus.
+    */
+
+    while (spi_busy())
+    {
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+        {
+            if (!hal_irq_enabled() && hal_spi_done())
+            {
+                _spi_service();
+            }
+        }
+        hal_idle();
+    }
+}
+
+ISR(SPI_STC_vect)
+{
+    /*
+    SPI transfer complete interrupt.
+    */
+
+    _spi_service();
+}
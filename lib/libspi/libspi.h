@@ -0,0 +1,39 @@
+/* 
+ * This file is part of the BASE-4 distribution (website).
+ * Copyright (c) 2018 Tim Buchanan.
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// SPI transaction queue. Drivers enqueue whole chip select frames and return
+// straight away, frames are clocked out by the SPI STC interrupt. High priority
+// frames (AD9833) are always sent before low priority frames (MAX7221), frames
+// are never interrupted part way through.
+
+#define SPI_FRAME_MAX           8           // max bytes under one chip select
+#define SPI_QUEUE_HI_LEN        8           // must be a power of 2
+#define SPI_QUEUE_LO_LEN        16          // must be a power of 2
+
+#define SPI_PRIO_LOW            0
+#define SPI_PRIO_HIGH           1
+
+#define SPI_MODE_0              0           // CPOL = 0 (MAX7221)
+#define SPI_MODE_2              (1 << CPOL) // CPOL = 1 (AD9833)
+
+// prototypes
+
+void spi_init(void);
+void spi_enqueue(uint8_t prio, uint8_t cs, uint8_t mode, const uint8_t *data, uint8_t len);
+uint8_t spi_busy(void);
+uint8_t spi_queued(uint8_t prio);
+void spi_flush(void);
@@ -0,0 +1,274 @@
+/* 
+ * This file is part of the BASE-4 distribution (website).
+ * Copyright (c) 2018 Tim Buchanan.
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "hal.h"
+#include "libuart.h"
+#include "libevent.h"
+
+uint8_t _uart_rx_buf[UART_RX_LEN];
+volatile uint8_t _uart_rx_head = 0;         // written by the RX interrupt only
+volatile uint8_t _uart_rx_tail = 0;         // written by the main loop only
+uint8_t _uart_tx_buf[UART_TX_LEN];
+volatile uint8_t _uart_tx_head = 0;         // written by the main loop only
+volatile uint8_t _uart_tx_tail = 0;         // written by the UDRE interrupt only
+volatile uint8_t _uart_tx_flow = 0;         // XON or XOFF to send ahead of the buffer
+uart_rx_hook_t _uart_rx_hook = 0;
+uint8_t _uart_rx_last = '\n';               // last byte stored, to find where lines end
+uint32_t _uart_stamps[UART_STAMPS];         // when each line ended, by line number
+volatile uint8_t _uart_lines_in = 0;        // lines ended by the RX interrupt
+uint8_t _uart_lines_out = 0;                // lines taken by the main loop
+volatile uint16_t uart_rx_errors = 0;       // bytes lost to overruns, framing errors or a full buffer
+
+uint8_t _uart_is_eol(uint8_t data)
+{
+    return (data == '\r') || (data == '\n');
+}
+
+void uart_init(void)
+{
+    /*
+    This function sets up USART0 at UART_BAUD, 8N1.
+    */
+
+    hal_uart_init(UART_UBRR);
+}
+
+uint8_t uart_getc(uint8_t *data)
+{
+    /*
+    This function takes the next received byte. Returns false if there is
+    none.
+    */
+
+    uint8_t tail = _uart_rx_tail;
+
+    if (tail == _uart_rx_head)
+    {
+        return 0;
+    }
+
+    *data = _uart_rx_buf[tail];
+    _uart_rx_tail = (tail + 1) & (UART_RX_LEN - 1);
+    return 1;
+}
+
+uint8_t uart_line_stamp(uint32_t *stamp)
+{
+    /*
+    This function gives the time the next line ended, call it once for every
+    line read. A line is any run of bytes ended by CR or LF, so CR LF is one
+    line. Returns false if so many lines arrived since that its time has been
+    written over.
+    */
+
+    uint8_t valid = 0;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        uint8_t waiting = _uart_lines_in - _uart_lines_out;
+
+        if (waiting)
+        {
+            if (waiting <= UART_STAMPS)
+            {
+                *stamp = _uart_stamps[_uart_lines_out & (UART_STAMPS - 1)];
+                valid = 1;
+            }
+            _uart_lines_out += 1;
+        }
+    }
+    return valid;
+}
+
+void uart_set_rx_hook(uart_rx_hook_t hook)
+{
+    /*
+    This function hands every received byte to hook, in interrupt context,
+    instead of buffering it. Bytes already buffered are passed on first so
+    none are reordered. A hook of 0 goes back to buffering lines, it can be
+    set from within the hook.
+    */
+
+    uint8_t data;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        _uart_rx_hook = hook;
+        _uart_rx_last = '\n';
+
+        // the hook may hand the UART back part way through
+        while (_uart_rx_hook && uart_getc(&data))
+        {
+            _uart_rx_hook(data);
+        }
+    }
+}
+
+void uart_put_flow(uint8_t data)
+{
+    /*
+    This function sends XON or XOFF ahead of anything already queued. It can
+    be called from interrupt context. If the last one hasn't gone yet it is
+    replaced.
+    */
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        _uart_tx_flow = data;
+        hal_uart_tx_irq(1);
+    }
+}
+
+void uart_putc(uint8_t data)
+{
+    /*
+    This function queues a byte to send. If the buffer is full it waits for
+    the UDRE interrupt to make room, so only call it from the main loop.
+    */
+
+    uint8_t head = _uart_tx_head;
+    uint8_t next = (head + 1) & (UART_TX_LEN - 1);
+
+    while (next == _uart_tx_tail)
+    {
+        hal_idle();
+    }
+
+    _uart_tx_buf[head] = data;
+    _uart_tx_head = next;
+    hal_uart_tx_irq(1);
+}
+
+void uart_puts(const char *s)
+{
+    while (*s)
+    {
+        uart_putc(*s++);
+    }
+}
+
+void uart_puts_P(const char *s)
+{
+    /*
+    This function sends a string held in program memory.
+    */
+
+    uint8_t c;
+
+    while ((c = pgm_read_byte(s++)))
+    {
+        uart_putc(c);
+    }
+}
+
+void uart_put_uint(uint32_t value)
+{
+    char digits[10];
+    uint8_t n = 0;
+
+    do
+    {
+        digits[n++] = '0' + (value % 10);
+        value /= 10;
+    } while (value);
+
+    while (n)
+    {
+        uart_putc(digits[--n]);
+    }
+}
+
+void uart_put_int(int32_t value)
+{
+    if (value < 0)
+    {
+        uart_putc('-');
+        uart_put_uint(-(uint32_t)value);
+    }
+    else
+    {
+        uart_put_uint(value);
+    }
+}
+
+ISR(USART_RX_vect)
+{
+    /*
+    UART receive interrupt. Stores the byte, and at the end of a line notes
+    the time and tells the main loop.
+    */
+
+    uint8_t error = hal_uart_rx_error();
+    uint8_t data = hal_uart_read();
+    uint8_t head = _uart_rx_head;
+    uint8_t next = (head + 1) & (UART_RX_LEN - 1);
+
+    if (error)
+    {
+        uart_rx_errors += 1;                // an earlier byte was lost, this one is still good
+    }
+    if (_uart_rx_hook)
+    {
+        _uart_rx_hook(data);
+        return;
+    }
+    if (next == _uart_rx_tail)
+    {
+        uart_rx_errors += 1;
+        return;
+    }
+
+    _uart_rx_buf[head] = data;
+    _uart_rx_head = next;
+
+    if (_uart_is_eol(data) && !_uart_is_eol(_uart_rx_last))
+    {
+        _uart_stamps[_uart_lines_in & (UART_STAMPS - 1)] = event_now();
+        _uart_lines_in += 1;
+        event_put(EVENT_SERIAL, 0);
+    }
+    else if (((next - _uart_rx_tail) & (UART_RX_LEN - 1)) == (UART_RX_LEN / 2))
+    {
+        event_put(EVENT_SERIAL, 0);         // a long line, start reading it before it overflows
+    }
+    _uart_rx_last = data;
+}
+
+ISR(USART_UDRE_vect)
+{
+    /*
+    UART data register empty interrupt. Sends a waiting XON/XOFF or the next
+    byte, or turns itself off when there is nothing left.
+    */
+
+    uint8_t tail = _uart_tx_tail;
+
+    if (_uart_tx_flow)
+    {
+        hal_uart_write(_uart_tx_flow);
+        _uart_tx_flow = 0;
+        return;
+    }
+    if (tail == _uart_tx_head)
+    {
+        hal_uart_tx_irq(0);
+        return;
+    }
+
+    hal_uart_write(_uart_tx_buf[tail]);
+    _uart_tx_tail = (tail + 1) & (UART_TX_LEN - 1);
+}
@@ -0,0 +1,53 @@
+/* 
+ * This file is part of the BASE-4 distribution (website).
+ * Copyright (c) 2018 Tim Buchanan.
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef LIBUART_H
+#define LIBUART_H
+
+// USART0 driver. Bytes go through a ring buffer each way, filled and emptied
+// by the RX and UDRE interrupts, so the main loop never waits on the wire.
+// Each index is only written by one side. An EVENT_SERIAL is queued when a
+// line ends (CR or LF), and the time it ended is kept for latency reports.
+
+#define UART_BAUD               115200UL
+#define UART_UBRR               ((F_CPU / (8 * UART_BAUD)) - 1)    // double speed, 16 gives 117647 baud (+2.1%)
+#define UART_RX_LEN             64          // must be a power of 2
+#define UART_TX_LEN             128         // must be a power of 2
+#define UART_STAMPS             8           // line end times kept, must be a power of 2
+
+#define UART_XON                0x11
+#define UART_XOFF               0x13
+
+// a receive hook takes each byte in interrupt context instead of the buffer
+typedef void (*uart_rx_hook_t)(uint8_t data);
+
+extern volatile uint16_t uart_rx_errors;
+
+// prototypes
+
+void uart_init(void);
+uint8_t uart_getc(uint8_t *data);
+uint8_t uart_line_stamp(uint32_t *stamp);
+void uart_set_rx_hook(uart_rx_hook_t hook);
+void uart_putc(uint8_t data);
+void uart_put_flow(uint8_t data);
+void uart_puts(const char *s);
+void uart_puts_P(const char *s);
+void uart_put_uint(uint32_t value);
+void uart_put_int(int32_t value);
+
+#endif /* LIBUART_H */
@@ -40,10 +40,12 @@
 *                       documentation!)
 * PB5 (13):             SPI SCK
 * PC0 (A0):             Standby switch input (DELETED)
-* PC1 (A1):             Output enable switch
-* PD3 (3/INT1):         Rotary encoder D0 input
-* PD4 (4):              Rotary encoder D1 input
-* PD2 (2/INT0):         Rotary encoder pushbutton
+* PC1 (A1/PCINT9):      Output enable switch
+* PD0 (0):              UART RXD (remote control, 115200 8N1)
+* PD1 (1):              UART TXD
+* PD3 (3/PCINT19):      Rotary encoder D0 input
+* PD4 (4/PCINT20):      Rotary encoder D1 input
+* PD2 (2):              Rotary encoder pushbutton (sampled each tick)
 * PB1 (9):              MAX7221 chip select (SPI)
 * PB0 (8):              AD9833 chip select (SPI) BODGE
 *
@@ -51,13 +53,12 @@
 * TIMER0:               Sweep timer
 * TIMER1:               System tick timer (30ms) (output compare A)
 *                       ADC start conversion (output compare B)
+* TIMER2:               Modulation sample timer (output compare A)
 * 
 ************************************************************************/
 
-#include <util/delay.h>
-#include <avr/io.h>
-#include <avr/interrupt.h>
 #include <stdlib.h>
+#include "hal.h"
 #include "libbase4.h"
 #include "base4.h"
 #include "globals.h"
@@ -65,9 +66,12 @@
 #include "libadc.h"
 #include "libmax7221.h"
 #include "librotaryencoder.h"
-
-volatile uint8_t tick_flag;
-volatile uint8_t sweep_increment_trig = 0;
+#include "libspi.h"
+#include "libpanel.h"
+#include "libevent.h"
+#include "libsched.h"
+#include "libremote.h"
+#include "libsettings.h"
 
 // digit flash variables
 
@@ -75,113 +79,56 @@ volatile uint8_t sweep_increment_trig = 0;
 
 int main()
 {
-    uint8_t is_ad9833_asleep = 0;           // true if AD9833 asleep, false otherwise
+    event_t event;
 
-    // pause to allow hardware to reset
-    _delay_ms(500);
+    hal_init();
+    HAL_BENCH_BEGIN(boot);
 
-    // init hardware
+    // let the supplies settle
+    _delay_ms(BOOT_SETTLE_MS);
 
-    //init_debug_pin();
+    // bring the output up first, with the settings saved in EEPROM if there
+    // are any. Everything here is polled, interrupts are still off
     spi_init();
-    max7221_init();
     adc_init();
+    set_initial_func_sel_state();
+    set_initial_disp_sel_state();
+    settings_load();
+    initial_setup();
+    spi_flush();
+    HAL_BENCH_END(boot);
+
+    // init the rest of the hardware
+
+    //init_debug_pin();
+    max7221_init();
     rotary_encoder_init();
+    panel_init();
+    remote_init();
 
     // init sweep timer, don't start it yet
     init_sweep_timer();
 
-    // read starting state of front panel
-    set_initial_func_sel_state();
-
-    // reset AD9833
-    AD9833_reset(0);
-
-    // display test and splash screen
-    max7221_blank_display();
-    display_test(1);
-    _delay_ms(1000);
-    display_test(0);
-    max7221_splash();
-    _delay_ms(3000);
-
-    // set initial frequency and phase
-    initial_setup();
+    // lamp test and splash screen, stepped by the display task
+    start_boot_display();
+    max7221_commit();
     
-    // init and start the tick timer (30ms)
+    // register the main loop tasks, then init and start the tick timer (30ms)
+    init_tasks();
     init_tick_timer();
 
     while (1)
     {
-        
-        
+        // sleep until an interrupt has queued something
+        event_wait();
 
-        if (sweep_increment_trig)
+        while (event_get(&event))
         {
-            sweep_increment();
-            sweep_increment_trig = 0;
+            handle_event(&event);
         }
-        
 
-    
-        if (tick_flag)
-        {
-            check_func_sel();
-
-            // if we are sweeping, lock out display select and rotary encoder and output enable
-            if (!(is_sweep_started))
-            {
-                check_disp_sel();
-                check_rotary_encoder();
-                check_rot_enc_pb();
-                
-                if (!(SW_PIN & (1 << OUTPUT_ENABLE_SW)) && !(is_ad9833_asleep))
-                {
-                    AD9833_sleep(1);
-                    is_ad9833_asleep = 1;
-
-                }
-                else if (SW_PIN & (1 << OUTPUT_ENABLE_SW) && is_ad9833_asleep)
-                {
-                    AD9833_sleep(0);
-                    AD9833_reset(0);
-                    check_func_sel();
-                    is_ad9833_asleep = 0;
-                }
-                
-            }
-
-            // digit flash 
-            check_digit_flash();
-            /*
-            if (is_digit_flashing)
-            {
-                digit_flash_tick_counter += 1;
-            }
-
-            if (digit_flash_tick_counter == 25)     // approx 0.75 seconds, blank digit
-            { 
-                max7221_putc(selected_digit, ' ');
-            }
-            if (digit_flash_tick_counter == 34)     // turn digit back on
-            {
-                update_display();
-                digit_flash_counter += 1;
-                digit_flash_tick_counter = 0;
-            }
-            if (digit_flash_counter > 4)            // stop flashing
-            {
-                is_digit_flashing = 0;
-                digit_flash_counter = 0;
-                digit_flash_tick_counter = 0;
-            }
-            */
-
-            
-            
-            
-            tick_flag = 0;
-            
-        }
+        HAL_BENCH_BEGIN(tick);
+        sched_run();
+        HAL_BENCH_END(tick);
     }
 }
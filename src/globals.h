@@ -15,6 +15,9 @@
  * along with this program. If not, see <http://www.gnu.org/licenses/>.
 */
 
+#ifndef GLOBALS_H
+#define GLOBALS_H
+
 // SPI defs
 #define SPI_DDR                 DDRB
 #define SPI_PORT                PORTB
@@ -70,14 +73,16 @@
 #define CHAR_Y                  0x3B
 #define CHAR_BLANK              0x00
 #define CHAR_DASH               0x01
+#define CHAR_UNDERSCORE         0x08
+#define CHAR_DP                 0x80        // decimal point, OR with any character
 
 // rotary encoder defines
 #define ROT_ENC_DDR             DDRD
 #define ROT_ENC_PORT            PORTD
 #define ROT_ENC_PIN             PIND
-#define ROT_ENC_D0              PD3         // INT1
-#define ROT_ENC_D1              PD4
-#define ROT_END_PB              PD2         // INT0
+#define ROT_ENC_D0              PD3         // PCINT19
+#define ROT_ENC_D1              PD4         // PCINT20
+#define ROT_END_PB              PD2
 
 // switch defines
 #define SW_DDR                  DDRC
@@ -100,8 +105,10 @@
 #define MIN_PHASE               0
 #define SWEEP_START_DEFAULT     100000UL
 #define SWEEP_STOP_DEFAULT      1000000UL
-#define SWEEP_TIME_DEFAULT      SWEEP_1000MS
-#define SWEEP_TIMER_OVF         200U         // changed from 64
+#define SWEEP_TIME_DEFAULT      1000UL      // ms
+#define SWEEP_TIME_MIN          1UL
+#define SWEEP_TIME_MAX          86400000UL  // 24 hours
+#define SWEEP_STEP_MIN_CYCLES   1608UL      // fastest sweep step, 100.5us
 #define TICK_TIMER_OVF          1875UL      // OC1A
 #define ADC_SC_OVF              487UL       // OC1B
 
@@ -153,5 +160,6 @@
 
 extern volatile uint16_t func_select_value;
 extern volatile uint16_t disp_select_value;
-extern volatile uint8_t sweep_increment_trig;
 extern uint8_t is_sweep_started;
+
+#endif /* GLOBALS_H */
@@ -0,0 +1,80 @@
+/* 
+ * This file is part of the BASE-4 distribution (website).
+ * Copyright (c) 2018 Tim Buchanan.
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// host tests for the AD9833 tuning word engine, run with pio test -e native
+
+#include <unity.h>
+#include "hal.h"
+#include "libad9833.h"
+#include "globals.h"
+
+void setUp(void)
+{
+}
+
+void tearDown(void)
+{
+}
+
+uint32_t _exact_tw(uint32_t freq)
+{
+    /*
+    This function is the reference, freq * 2^28 / AD9833_CLOCK rounded to
+    nearest in 64 bit arithmetic.
+    */
+
+    return (((uint64_t)freq << AD9833_TW_BITS) + (AD9833_CLOCK / 2)) / AD9833_CLOCK;
+}
+
+void test_freq_to_tw_exact(void)
+{
+    /*
+    Every frequency the generator can be set to converts to the exactly
+    rounded tuning word.
+    */
+
+    for (uint32_t freq = 0; freq <= MAX_FREQ; freq++)
+    {
+        if (AD9833_freq_to_tw(freq) != _exact_tw(freq))
+        {
+            TEST_ASSERT_EQUAL_UINT32(_exact_tw(freq), AD9833_freq_to_tw(freq));
+        }
+    }
+}
+
+void test_tw_to_freq_round_trip(void)
+{
+    /*
+    Converting back gives the frequency that was asked for.
+    */
+
+    for (uint32_t freq = 0; freq <= MAX_FREQ; freq += 7)
+    {
+        if (AD9833_tw_to_freq(AD9833_freq_to_tw(freq)) != freq)
+        {
+            TEST_ASSERT_EQUAL_UINT32(freq, AD9833_tw_to_freq(AD9833_freq_to_tw(freq)));
+        }
+    }
+}
+
+int main(void)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_freq_to_tw_exact);
+    RUN_TEST(test_tw_to_freq_round_trip);
+    return UNITY_END();
+}
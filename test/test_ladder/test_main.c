@@ -0,0 +1,138 @@
+/* 
+ * This file is part of the BASE-4 distribution (website).
+ * Copyright (c) 2018 Tim Buchanan.
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// host tests for the selector ladder decoder, run with pio test -e native.
+// The traces are averaged samples as the scanner publishes them, made up to
+// look like a noisy pot and a bouncing switch: replace them with captures
+// from a real panel when there are some
+
+#include <unity.h>
+#include "hal.h"
+#include "libadc.h"
+
+// each position decodes to its own index
+const uint8_t _test_values[ADC_LADDER_POSITIONS] PROGMEM = {0, 1, 2, 3, 4, 5};
+
+adc_ladder_t _ladder;
+uint8_t _seq;
+
+// position 0 (601 to 1023), noise of about +-8 counts close to its low edge
+const uint16_t _trace_edge_noise[] =
+{
+    604, 598, 601, 596, 607, 599, 594, 603, 600, 597, 605, 595, 598, 602, 596, 593
+};
+
+// position 1 (481 to 549) to 2 (301 to 369), turned slowly through the gap
+// with one bounce back
+const uint16_t _trace_turn[] =
+{
+    515, 517, 514, 470, 425, 371, 352, 516, 340, 338, 341, 337, 339
+};
+
+// between position 4 (186 to 218) and 5 (0 to 183), chattering on the gap
+const uint16_t _trace_chatter[] =
+{
+    190, 184, 181, 187, 180, 185, 183, 188, 182, 186, 179, 184
+};
+
+void setUp(void)
+{
+    _ladder.values = _test_values;
+    _ladder.position = ADC_LADDER_NONE;
+    _ladder.candidate = ADC_LADDER_NONE;
+    _ladder.count = 0;
+    _ladder.seq = 0;
+    _seq = 0;
+}
+
+void tearDown(void)
+{
+}
+
+uint8_t _feed(uint16_t reading)
+{
+    /*
+    This function decodes one new sample.
+    */
+
+    _seq += 1;
+    return adc_ladder_decode(&_ladder, reading, _seq);
+}
+
+void test_first_sample_picks_nearest(void)
+{
+    TEST_ASSERT_EQUAL_UINT8(ADC_LADDER_NONE, adc_ladder_value(&_ladder));
+    TEST_ASSERT_EQUAL_UINT8(2, _feed(290));                 // gap below position 2
+    TEST_ASSERT_EQUAL_UINT8(2, adc_ladder_value(&_ladder));
+}
+
+void test_edge_noise_holds(void)
+{
+    _feed(800);
+    for (uint8_t i = 0; i < sizeof(_trace_edge_noise) / sizeof(_trace_edge_noise[0]); i++)
+    {
+        TEST_ASSERT_EQUAL_UINT8(0, _feed(_trace_edge_noise[i]));
+    }
+}
+
+void test_turn_waits_for_stable_samples(void)
+{
+    static const uint8_t expected[] = {1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 2, 2, 2};
+
+    for (uint8_t i = 0; i < sizeof(_trace_turn) / sizeof(_trace_turn[0]); i++)
+    {
+        TEST_ASSERT_EQUAL_UINT8(expected[i], _feed(_trace_turn[i]));
+    }
+}
+
+void test_chatter_holds(void)
+{
+    _feed(200);
+    for (uint8_t i = 0; i < sizeof(_trace_chatter) / sizeof(_trace_chatter[0]); i++)
+    {
+        TEST_ASSERT_EQUAL_UINT8(4, _feed(_trace_chatter[i]));
+    }
+}
+
+void test_repeated_sample_counted_once(void)
+{
+    /*
+    The selector task looks more often than the scanner publishes, the same
+    sample decoded again must not count towards a change.
+    */
+
+    _feed(515);
+    _seq += 1;
+    for (uint8_t i = 0; i < 10; i++)
+    {
+        TEST_ASSERT_EQUAL_UINT8(1, adc_ladder_decode(&_ladder, 340, _seq));
+    }
+    TEST_ASSERT_EQUAL_UINT8(1, _feed(340));
+    TEST_ASSERT_EQUAL_UINT8(2, _feed(340));
+    TEST_ASSERT_EQUAL_UINT8(2, adc_ladder_value(&_ladder));
+}
+
+int main(void)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_first_sample_picks_nearest);
+    RUN_TEST(test_edge_noise_holds);
+    RUN_TEST(test_turn_waits_for_stable_samples);
+    RUN_TEST(test_chatter_holds);
+    RUN_TEST(test_repeated_sample_counted_once);
+    return UNITY_END();
+}
@@ -0,0 +1,223 @@
+/* 
+ * This file is part of the BASE-4 distribution (website).
+ * Copyright (c) 2018 Tim Buchanan.
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// host tests for the sweep engine, run with pio test -e native. The step
+// arithmetic only uses fixed width types, so the host gives the same tuning
+// words as the AVR (where unsigned long is 32 bits)
+
+#include <unity.h>
+#include "hal.h"
+#include "libbase4.h"
+#include "libad9833.h"
+#include "globals.h"
+
+extern uint32_t sweep_tw;
+extern uint32_t sweep_steps;
+extern uint32_t sweep_start_tw;
+extern uint32_t sweep_stop_tw;
+extern int32_t sweep_endpoint_error;
+
+void setUp(void)
+{
+    sweep_time = SWEEP_TIME_DEFAULT;
+}
+
+void tearDown(void)
+{
+}
+
+uint32_t _round_shift(uint32_t m, uint8_t shift)
+{
+    /*
+    This function is the reference for sweep_log_tw(), m / 2^shift rounded to
+    nearest without any sum that could carry.
+    */
+
+    return (m >> shift) + ((m >> (shift - 1)) & 1);
+}
+
+void _run_sweep(uint8_t mode, uint32_t start, uint32_t stop)
+{
+    /*
+    This function runs one whole sweep and checks that every step is a real
+    tuning word between the endpoints, that the steps move one way only and
+    that the sweep starts and ends on the endpoints. A log sweep must also
+    arrive at the stop by itself, to within the rounding of its ratio (one
+    ratio bit is steps / 2^32 of the stop), before it is snapped there.
+    */
+
+    uint32_t last;
+    uint32_t low = AD9833_freq_to_tw((start < stop) ? start : stop);
+    uint32_t high = AD9833_freq_to_tw((start < stop) ? stop : start);
+
+    sweep_mode = mode;
+    sweep_start_freq = start;
+    sweep_stop_freq = stop;
+    calculate_sweep_delta();
+    sweep_restart();
+
+    TEST_ASSERT_EQUAL_UINT32(AD9833_freq_to_tw(start), sweep_tw);
+    last = sweep_tw;
+    for (uint32_t i = 1; i < sweep_steps; i++)
+    {
+        sweep_increment();
+        TEST_ASSERT_TRUE_MESSAGE(sweep_tw != 0, "step went to 0 Hz");
+        TEST_ASSERT_TRUE_MESSAGE((sweep_tw >= low) && (sweep_tw <= high), "step is outside the sweep");
+        if (stop > start)
+        {
+            TEST_ASSERT_TRUE_MESSAGE(sweep_tw >= last, "step went down");
+        }
+        else
+        {
+            TEST_ASSERT_TRUE_MESSAGE(sweep_tw <= last, "step went up");
+        }
+        last = sweep_tw;
+    }
+    TEST_ASSERT_EQUAL_UINT32(AD9833_freq_to_tw(stop), sweep_tw);
+
+    if (mode == FUNC_LOG_SWEEP)
+    {
+        int32_t allowed = (((uint64_t)sweep_stop_tw * sweep_steps * 4) >> 32) + 4;
+
+        TEST_ASSERT_INT32_WITHIN_MESSAGE(allowed, 0, sweep_endpoint_error, "log sweep missed its stop");
+    }
+}
+
+void _check_log_midpoint(uint32_t start, uint32_t stop)
+{
+    /*
+    This function checks a log sweep is halfway in ratio at its middle step,
+    to within 2%, so it is not flat and then jumping.
+    */
+
+    uint64_t mid_sq;
+    uint64_t tw_sq;
+
+    sweep_mode = FUNC_LOG_SWEEP;
+    sweep_start_freq = start;
+    sweep_stop_freq = stop;
+    calculate_sweep_delta();
+    sweep_restart();
+    for (uint32_t i = 1; i <= (sweep_steps - 1) / 2; i++)
+    {
+        sweep_increment();
+    }
+
+    mid_sq = (uint64_t)sweep_start_tw * sweep_stop_tw;
+    tw_sq = (uint64_t)sweep_tw * sweep_tw;
+    TEST_ASSERT_TRUE_MESSAGE((tw_sq > mid_sq - (mid_sq / 50)) && (tw_sq < mid_sq + (mid_sq / 50)),
+                             "log sweep is not halfway at its middle");
+}
+
+void test_log_tw_rounding(void)
+{
+    /*
+    The rounding carries past bit 31 when the mantissa is near the top, this
+    sent 0 to the AD9833 with 32 bit arithmetic.
+    */
+
+    TEST_ASSERT_EQUAL_UINT32(16, sweep_log_tw(0xF82CCAECUL, 28));
+    for (uint8_t shift = 1; shift < 32; shift++)
+    {
+        TEST_ASSERT_EQUAL_UINT32(_round_shift(0xFFFFFFFFUL, shift), sweep_log_tw(0xFFFFFFFFUL, shift));
+        TEST_ASSERT_EQUAL_UINT32(_round_shift(0x80000000UL, shift), sweep_log_tw(0x80000000UL, shift));
+        TEST_ASSERT_EQUAL_UINT32(_round_shift(0xF82CCAECUL, shift), sweep_log_tw(0xF82CCAECUL, shift));
+    }
+}
+
+void test_log_sweep_up(void)
+{
+    _run_sweep(FUNC_LOG_SWEEP, 1, MAX_FREQ);
+    _run_sweep(FUNC_LOG_SWEEP, SWEEP_START_DEFAULT, SWEEP_STOP_DEFAULT);
+    sweep_time = 1;
+    _run_sweep(FUNC_LOG_SWEEP, 1000, 2000);
+    _run_sweep(FUNC_LOG_SWEEP, 1, MAX_FREQ);    // several octaves a step
+    sweep_time = 2;
+    _run_sweep(FUNC_LOG_SWEEP, 10, 1000000);
+}
+
+void test_log_sweep_down(void)
+{
+    _run_sweep(FUNC_LOG_SWEEP, MAX_FREQ, 1);
+    _run_sweep(FUNC_LOG_SWEEP, SWEEP_STOP_DEFAULT, SWEEP_START_DEFAULT);
+    sweep_time = 1;
+    _run_sweep(FUNC_LOG_SWEEP, 2000, 1000);
+    _run_sweep(FUNC_LOG_SWEEP, MAX_FREQ, 1);
+    sweep_time = 2;
+    _run_sweep(FUNC_LOG_SWEEP, 1000000, 10);
+}
+
+void test_log_sweep_zero(void)
+{
+    /*
+    The encoder could take the stop to 0 Hz, and working out the log ratio
+    for a 0 tuning word never finished.
+    */
+
+    sweep_mode = FUNC_LOG_SWEEP;
+    sweep_start_freq = 1000;
+    sweep_stop_freq = 0;
+    calculate_sweep_delta();
+    TEST_ASSERT_EQUAL_UINT32(1, sweep_stop_tw);
+    sweep_start_freq = 0;
+    sweep_stop_freq = 1000;
+    calculate_sweep_delta();
+    TEST_ASSERT_EQUAL_UINT32(1, sweep_start_tw);
+}
+
+void test_log_sweep_long(void)
+{
+    /*
+    Sweeps of more than a few seconds have up to SWEEP_MAX_STEPS steps, the
+    ratio bisection overflowed its exponents on these.
+    */
+
+    const uint32_t times[] = {5000, 10000, 20000, 60000, SWEEP_TIME_MAX};
+
+    for (uint8_t i = 0; i < sizeof(times) / sizeof(times[0]); i++)
+    {
+        sweep_time = times[i];
+        _run_sweep(FUNC_LOG_SWEEP, 1, MAX_FREQ);
+        _run_sweep(FUNC_LOG_SWEEP, MAX_FREQ, 1);
+        _run_sweep(FUNC_LOG_SWEEP, SWEEP_START_DEFAULT, SWEEP_STOP_DEFAULT);
+    }
+}
+
+void test_log_sweep_shape(void)
+{
+    _check_log_midpoint(10, 1000000);
+    _check_log_midpoint(1000000, 10);
+}
+
+void test_lin_sweep(void)
+{
+    _run_sweep(FUNC_LIN_SWEEP, SWEEP_START_DEFAULT, SWEEP_STOP_DEFAULT);
+    _run_sweep(FUNC_LIN_SWEEP, SWEEP_STOP_DEFAULT, SWEEP_START_DEFAULT);
+}
+
+int main(void)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_log_tw_rounding);
+    RUN_TEST(test_log_sweep_up);
+    RUN_TEST(test_log_sweep_down);
+    RUN_TEST(test_log_sweep_long);
+    RUN_TEST(test_log_sweep_zero);
+    RUN_TEST(test_log_sweep_shape);
+    RUN_TEST(test_lin_sweep);
+    return UNITY_END();
+}
@@ -0,0 +1,477 @@
+/* 
+ * This file is part of the BASE-4 distribution (website).
+ * Copyright (c) 2018 Tim Buchanan.
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/************************************************************************
+* FILENAME :        bench.c
+*
+* DESCRIPTION :
+*       Runs the AVR build (env:bench) inside simavr and times the
+*       benchmark points from bench_ids.h and every interrupt handler, in
+*       CPU cycles. Inputs are driven from a script in the same format as
+*       the native simulator (BASE4_SIM_SCRIPT):
+*           <ms> adc <channel> <value>
+*           <ms> pin <B|C|D> <bit> <0|1>
+*           <ms> uart <text>
+*       Results are written as JSON. The exit status is 1 if the sweep
+*       interrupt, a tick or startup went over its budget. A budget whose
+*       point or vector never ran is reported as not checked rather than
+*       passed, and every point and vector that never ran is listed under
+*       "not_hit", so a wrong vector number or marker shows up in the
+*       first run instead of passing quietly. If the
+*       modulation engine ran, each sample is also timed from the TIMER2
+*       compare match until its last AD9833 word is out. The longest gives
+*       the highest sample (or PSK symbol) rate it can keep up, the spread is
+*       the jitter on the output edges. The exit status is also 1 if that
+*       is below MOD_RATE_MAX, the highest rate the firmware accepts. The
+*       time from reset until the AD9833
+*       has been set up (the end of the boot point) is reported as the power
+*       on to valid output time.
+*
+* USAGE :
+*       bench [-o results.json] [-s input.script] [-t ms] firmware.elf
+*
+* NOTES :
+*       UNVERIFIED. This runner has not yet been run under simavr, so there
+*       are no baseline numbers. The isrs[] vector numbers and the GPIOR0
+*       address (BENCH_GPIOR0) have only been checked against the ATmega328P
+*       datasheet, and bench_ids.h only against the firmware source. On the
+*       first run, anything under "not_hit" that the script should have
+*       reached points at one of these.
+*
+************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include "sim_avr.h"
+#include "sim_elf.h"
+#include "sim_irq.h"
+#include "sim_interrupts.h"
+#include "avr_ioport.h"
+#include "avr_adc.h"
+#include "avr_uart.h"
+#include "globals.h"
+#include "bench_ids.h"
+#include "libmodulation.h"
+
+#define BENCH_MCU               "atmega328p"
+#define BENCH_F_CPU             16000000UL
+#define BENCH_VCC_MV            5000
+#define BENCH_GPIOR0            0x3E        // data space address
+#define BENCH_SCRIPT_MAX        256
+#define BENCH_POINT_MAX         0x80
+#define BENCH_TEXT_MAX          80
+
+// budgets, in cycles
+#define SWEEP_BUDGET            SWEEP_STEP_MIN_CYCLES
+#define TICK_BUDGET             (256UL * (TICK_TIMER_OVF + 1))
+#define BOOT_BUDGET             (20UL * (BENCH_F_CPU / 1000UL))     // 20 ms
+
+#define SWEEP_ISR               (&isrs[4])  // TIMER0_COMPA_vect
+#define MOD_ISR                 (&isrs[2])  // TIMER2_COMPA_vect
+
+typedef struct
+{
+    const char *name;
+    uint8_t vector;                         // 0 for a firmware marker
+    uint8_t open;
+    uint64_t start;
+    uint64_t count;
+    uint64_t min;
+    uint64_t max;
+    uint64_t total;
+} bench_stat_t;
+
+typedef struct
+{
+    uint64_t at;                            // cycle
+    char cmd;
+    char port;
+    uint16_t a;
+    uint16_t b;
+    char text[BENCH_TEXT_MAX];              // uart line, without the newline
+} bench_input_t;
+
+avr_t *avr;
+bench_stat_t points[BENCH_POINT_MAX];
+bench_stat_t isrs[] =
+{
+    {.name = "PCINT1_vect", .vector = 4},
+    {.name = "PCINT2_vect", .vector = 5},
+    {.name = "TIMER2_COMPA_vect", .vector = 7},
+    {.name = "TIMER1_COMPA_vect", .vector = 11},
+    {.name = "TIMER0_COMPA_vect", .vector = 14},
+    {.name = "SPI_STC_vect", .vector = 17},
+    {.name = "USART_RX_vect", .vector = 18},
+    {.name = "USART_UDRE_vect", .vector = 19},
+    {.name = "ADC_vect", .vector = 21},
+    {.name = "EE_READY_vect", .vector = 22},
+};
+bench_stat_t edge = {.name = "mod_edge"};   // TIMER2 compare match to the last AD9833 word
+uint64_t boot_done = 0;                     // cycle the output became valid, 0 if it never did
+bench_input_t script[BENCH_SCRIPT_MAX];
+uint16_t script_len = 0;
+
+void stat_begin(bench_stat_t *stat)
+{
+    stat->start = avr->cycle;
+    stat->open = 1;
+}
+
+void stat_end(bench_stat_t *stat)
+{
+    uint64_t cycles;
+
+    if (!stat->open)
+    {
+        return;
+    }
+    stat->open = 0;
+    cycles = avr->cycle - stat->start;
+
+    if ((stat->count == 0) || (cycles < stat->min)) stat->min = cycles;
+    if (cycles > stat->max) stat->max = cycles;
+    stat->total += cycles;
+    stat->count += 1;
+}
+
+void marker_write(struct avr_t *avr, avr_io_addr_t addr, uint8_t v, void *param)
+{
+    /*
+    This function is called for every write to GPIOR0.
+    */
+
+    bench_stat_t *stat = &points[v & ~BENCH_END];
+
+    avr->data[addr] = v;
+
+    if (stat->name == 0)
+    {
+        return;
+    }
+    if (v & BENCH_END)
+    {
+        stat_end(stat);
+        if (stat == &points[BENCH_mod_sample])
+        {
+            stat_end(&edge);
+        }
+        else if ((stat == &points[BENCH_boot]) && (boot_done == 0))
+        {
+            boot_done = avr->cycle;
+        }
+    }
+    else
+    {
+        stat_begin(stat);
+    }
+}
+
+void isr_running(struct avr_irq_t *irq, uint32_t value, void *param)
+{
+    /*
+    This function is called when a vector is entered (value 1) and on its reti
+    (value 0).
+    */
+
+    if (value)
+    {
+        stat_begin(param);
+    }
+    else
+    {
+        stat_end(param);
+    }
+}
+
+void mod_pending(struct avr_irq_t *irq, uint32_t value, void *param)
+{
+    /*
+    This function is called when the TIMER2 compare match raises its
+    interrupt (value 1). Samples that send nothing leave the edge open,
+    the next compare match starts it again.
+    */
+
+    if (value)
+    {
+        stat_begin(&edge);
+    }
+}
+
+void load_script(const char *path)
+{
+    FILE *f = fopen(path, "r");
+    char line[128];
+
+    if (f == 0)
+    {
+        fprintf(stderr, "bench: can't open script %s\n", path);
+        exit(2);
+    }
+
+    while (fgets(line, sizeof(line), f) && (script_len < BENCH_SCRIPT_MAX))
+    {
+        bench_input_t *input = &script[script_len];
+        double ms;
+        char cmd[8];
+        char port;
+        unsigned a = 0;
+        unsigned b = 0;
+        int text = 0;
+
+        if ((line[0] == '#') || (sscanf(line, "%lf %7s", &ms, cmd) != 2))
+        {
+            continue;
+        }
+        input->at = (uint64_t)(ms * (BENCH_F_CPU / 1000UL));
+        if (!strcmp(cmd, "adc") && (sscanf(line, "%*f %*s %u %u", &a, &b) == 2))
+        {
+            input->cmd = 'a';
+        }
+        else if (!strcmp(cmd, "pin") && (sscanf(line, "%*f %*s %c %u %u", &port, &a, &b) == 3))
+        {
+            input->cmd = 'p';
+            input->port = port;
+        }
+        else if (!strcmp(cmd, "uart") && (sscanf(line, "%*f %*s %n", &text) == 0) && text)
+        {
+            input->cmd = 'u';
+            strncpy(input->text, line + text, BENCH_TEXT_MAX - 1);
+            input->text[strcspn(input->text, "\r\n")] = 0;
+        }
+        else
+        {
+            fprintf(stderr, "bench: bad script line: %s", line);
+            continue;
+        }
+        input->a = a;
+        input->b = b;
+        script_len++;
+    }
+    fclose(f);
+}
+
+void apply_input(bench_input_t *input)
+{
+    if (input->cmd == 'a')
+    {
+        // script values are ADC counts, simavr wants millivolts
+        uint32_t mv = ((uint32_t)input->b * BENCH_VCC_MV + 512) / 1023;
+
+        avr_raise_irq(avr_io_getirq(avr, AVR_IOCTL_ADC_GETIRQ, ADC_IRQ_ADC0 + input->a), mv);
+    }
+    else if (input->cmd == 'u')
+    {
+        // simavr paces the bytes out of its receive FIFO at the baud rate
+        avr_irq_t *rx = avr_io_getirq(avr, AVR_IOCTL_UART_GETIRQ('0'), UART_IRQ_INPUT);
+
+        for (char *c = input->text; *c; c++)
+        {
+            avr_raise_irq(rx, (uint8_t)*c);
+        }
+        avr_raise_irq(rx, '\n');
+    }
+    else
+    {
+        avr_raise_irq(avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ(input->port), input->a), input->b);
+    }
+}
+
+const char *budget_result(uint64_t count, uint8_t ok)
+{
+    /*
+    This function returns the JSON for a budget result, null if what it
+    times never ran.
+    */
+
+    return count ? (ok ? "true" : "false") : "null";
+}
+
+void write_not_hit(FILE *out, bench_stat_t *stat, uint8_t *first)
+{
+    /*
+    This function adds a point or vector to the not_hit list if it never ran.
+    */
+
+    if (stat->name && (stat->count == 0))
+    {
+        fprintf(out, "%s\"%s\"", *first ? "" : ", ", stat->name);
+        *first = 0;
+    }
+}
+
+void write_stat(FILE *out, bench_stat_t *stat, uint8_t first)
+{
+    fprintf(out, "%s    {\"name\": \"%s\", \"count\": %llu, \"min\": %llu, \"max\": %llu, \"mean\": %.1f, \"max_us\": %.2f}",
+            first ? "" : ",\n", stat->name, (unsigned long long)stat->count, (unsigned long long)stat->min,
+            (unsigned long long)stat->max, stat->count ? (double)stat->total / stat->count : 0.0,
+            stat->max / (BENCH_F_CPU / 1e6));
+}
+
+int main(int argc, char *argv[])
+{
+    const char *out_path = "bench.json";
+    const char *script_path = 0;
+    uint64_t end = 12000ULL * (BENCH_F_CPU / 1000UL);
+    elf_firmware_t firmware;
+    uint16_t script_pos = 0;
+    uint8_t n_isrs = sizeof(isrs) / sizeof(isrs[0]);
+    uint8_t sweep_ok;
+    uint8_t tick_ok;
+    uint8_t boot_ok;
+    uint8_t mod_ok;
+    uint8_t first;
+    double mod_rate_max;
+    FILE *out;
+    int opt;
+    int state = cpu_Running;
+
+    while ((opt = getopt(argc, argv, "o:s:t:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'o': out_path = optarg; break;
+            case 's': script_path = optarg; break;
+            case 't': end = (uint64_t)atol(optarg) * (BENCH_F_CPU / 1000UL); break;
+            default:
+                fprintf(stderr, "usage: %s [-o results.json] [-s input.script] [-t ms] firmware.elf\n", argv[0]);
+                return 2;
+        }
+    }
+    if (optind >= argc)
+    {
+        fprintf(stderr, "bench: no firmware given\n");
+        return 2;
+    }
+
+    memset(&firmware, 0, sizeof(firmware));
+    if (elf_read_firmware(argv[optind], &firmware))
+    {
+        fprintf(stderr, "bench: can't load %s\n", argv[optind]);
+        return 2;
+    }
+    if (script_path)
+    {
+        load_script(script_path);
+    }
+
+    avr = avr_make_mcu_by_name(BENCH_MCU);
+    if (avr == 0)
+    {
+        fprintf(stderr, "bench: simavr has no %s core\n", BENCH_MCU);
+        return 2;
+    }
+    avr_init(avr);
+    avr->frequency = BENCH_F_CPU;
+    avr->vcc = avr->avcc = avr->aref = BENCH_VCC_MV;
+    avr_load_firmware(avr, &firmware);
+
+#define BENCH_NAME(id, point)   points[id].name = #point;
+    BENCH_POINTS(BENCH_NAME)
+    avr_register_io_write(avr, BENCH_GPIOR0, marker_write, 0);
+
+    for (uint8_t i = 0; i < n_isrs; i++)
+    {
+        avr_irq_t *irq = avr_get_interrupt_irq(avr, isrs[i].vector);
+
+        if (irq)
+        {
+            avr_irq_register_notify(irq + AVR_INT_IRQ_RUNNING, isr_running, &isrs[i]);
+        }
+    }
+    avr_irq_register_notify(avr_get_interrupt_irq(avr, MOD_ISR->vector) + AVR_INT_IRQ_PENDING, mod_pending, 0);
+
+    while ((avr->cycle < end) && (state != cpu_Done) && (state != cpu_Crashed))
+    {
+        while ((script_pos < script_len) && (script[script_pos].at <= avr->cycle))
+        {
+            apply_input(&script[script_pos++]);
+        }
+        state = avr_run(avr);
+    }
+    if (state == cpu_Crashed)
+    {
+        fprintf(stderr, "bench: firmware crashed at %.3f ms\n", avr->cycle / (BENCH_F_CPU / 1000.0));
+    }
+
+    // nothing to judge if the sweep or tick never ran, see budget_result()
+    sweep_ok = (SWEEP_ISR->max <= SWEEP_BUDGET);
+    tick_ok = (points[BENCH_tick].count != 0) && (points[BENCH_tick].max <= TICK_BUDGET);
+    boot_ok = boot_done && (boot_done <= BOOT_BUDGET);
+    mod_rate_max = edge.max ? ((double)BENCH_F_CPU / edge.max) : 0.0;
+    mod_ok = (edge.count == 0) || (mod_rate_max >= MOD_RATE_MAX);
+
+    out = fopen(out_path, "w");
+    if (out == 0)
+    {
+        fprintf(stderr, "bench: can't write %s\n", out_path);
+        return 2;
+    }
+    fprintf(out, "{\n  \"firmware\": \"%s\",\n  \"f_cpu\": %lu,\n  \"cycles\": %llu,\n  \"crashed\": %s,\n",
+            argv[optind], BENCH_F_CPU, (unsigned long long)avr->cycle, (state == cpu_Crashed) ? "true" : "false");
+    fprintf(out, "  \"functions\": [\n");
+    for (uint8_t id = 0, first = 1; id < BENCH_POINT_MAX; id++)
+    {
+        if (points[id].name)
+        {
+            write_stat(out, &points[id], first);
+            first = 0;
+        }
+    }
+    fprintf(out, "\n  ],\n  \"isrs\": [\n");
+    for (uint8_t i = 0; i < n_isrs; i++)
+    {
+        write_stat(out, &isrs[i], (i == 0));
+    }
+    fprintf(out, "\n  ],\n  \"not_hit\": [");
+    first = 1;
+    for (uint8_t id = 0; id < BENCH_POINT_MAX; id++)
+    {
+        write_not_hit(out, &points[id], &first);
+    }
+    for (uint8_t i = 0; i < n_isrs; i++)
+    {
+        write_not_hit(out, &isrs[i], &first);
+    }
+    fprintf(out, "],\n  \"budgets\": [\n");
+    fprintf(out, "    {\"name\": \"sweep_isr\", \"limit\": %lu, \"worst\": %llu, \"ok\": %s},\n",
+            SWEEP_BUDGET, (unsigned long long)SWEEP_ISR->max, budget_result(SWEEP_ISR->count, sweep_ok));
+    fprintf(out, "    {\"name\": \"tick\", \"limit\": %lu, \"worst\": %llu, \"ok\": %s},\n",
+            TICK_BUDGET, (unsigned long long)points[BENCH_tick].max, budget_result(points[BENCH_tick].count, tick_ok));
+    fprintf(out, "    {\"name\": \"boot\", \"limit\": %lu, \"worst\": %llu, \"ok\": %s}\n  ],\n",
+            BOOT_BUDGET, (unsigned long long)boot_done, budget_result(boot_done, boot_ok));
+    fprintf(out, "  \"boot\": {\"output_valid_cycles\": %llu, \"output_valid_ms\": %.3f},\n",
+            (unsigned long long)boot_done, boot_done / (BENCH_F_CPU / 1e3));
+    fprintf(out, "  \"modulation\": {\"samples\": %llu, \"edge_min\": %llu, \"edge_max\": %llu, \"jitter_us\": %.2f, \"max_rate\": %.0f, \"rate_setting_max\": %lu, \"ok\": %s}\n}\n",
+            (unsigned long long)edge.count, (unsigned long long)edge.min, (unsigned long long)edge.max,
+            (edge.max - edge.min) / (BENCH_F_CPU / 1e6), mod_rate_max, MOD_RATE_MAX,
+            budget_result(edge.count, mod_ok));
+    fclose(out);
+
+    printf("sweep isr worst %llu of %lu cycles, tick worst %llu of %lu cycles\n",
+           (unsigned long long)SWEEP_ISR->max, SWEEP_BUDGET, (unsigned long long)points[BENCH_tick].max, TICK_BUDGET);
+    printf("output valid %.3f ms after power on\n", boot_done / (BENCH_F_CPU / 1e3));
+    if (edge.count)
+    {
+        printf("modulation edge %llu to %llu cycles after the compare match, %.0f samples/s max (MOD_RATE_MAX %lu)\n",
+               (unsigned long long)edge.min, (unsigned long long)edge.max, mod_rate_max, MOD_RATE_MAX);
+    }
+
+    return (sweep_ok && tick_ok && boot_ok && mod_ok && (state != cpu_Crashed)) ? 0 : 1;
+}